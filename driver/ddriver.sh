@@ -5,8 +5,11 @@ KERNEL_DDRIVER="./kernel_ddriver"
 KERNEL_DEV_PATH="/dev/ddriver"
 
 USER_DDRIVER="./user_ddriver"
-USER_LOG_PATH="$HOME/ddriver_log"
-USER_DEV_PATH="$HOME/ddriver"
+# 用户设备可以是任意镜像文件，由$DDRIVER_DEVICE指定，日志为<设备路径>_log
+USER_DEV_PATH="${DDRIVER_DEVICE:-$HOME/ddriver}"
+[[ "$USER_DEV_PATH" != /* ]] && USER_DEV_PATH="$ORIGIN_WORK_DIR/$USER_DEV_PATH"
+USER_LOG_PATH="${USER_DEV_PATH}_log"
+USER_SNAP_BIN="./user_ddriver/bin/ddriver_snap"
 
 
 if [ -L "$0" ]; then
@@ -18,8 +21,66 @@ fi
 
 cd "$WORK_DIR" || exit
 
-CONFIG_BLOCK_SZ=512
-BLOCK_COUNT=8192
+# 设备几何参数与libddriver一致：默认值 < $DDRIVER_CONFIG 配置文件 < DDRIVER_<KEY> 环境变量
+function config_raw() {
+    local key=$1 val=$2 env_name
+    if [ -n "$DDRIVER_CONFIG" ] && [ -f "$DDRIVER_CONFIG" ]; then
+        local line
+        line=$(grep -E "^[[:space:]]*$key[[:space:]]*=" "$DDRIVER_CONFIG" | tail -n 1)
+        if [ -n "$line" ]; then
+            val=$(echo "${line#*=}" | tr -d '[:space:]')
+        fi
+    fi
+    env_name="DDRIVER_${key^^}"
+    if [ -n "${!env_name}" ]; then
+        val=${!env_name}
+    fi
+    echo "$val"
+}
+
+# 与ddriver_parse_size相同：按C语言规则解析数值 (0x十六进制、0开头八进制)，
+# 紧随其后的K/M/G/T (不区分大小写) 为1024进制后缀，其余后缀文字忽略
+function config_get() {
+    local raw num shift=0
+    raw=$(config_raw "$1" "$2")
+    if [[ ! "$raw" =~ ^[[:space:]]*(0[xX][0-9a-fA-F]+|0[0-7]*|[1-9][0-9]*)(.?) ]]; then
+        echo "无法解析配置 $1=$raw" >&2
+        return 1
+    fi
+    num=${BASH_REMATCH[1]}
+    case ${BASH_REMATCH[2]} in
+        [tT]) shift=40 ;;
+        [gG]) shift=30 ;;
+        [mM]) shift=20 ;;
+        [kK]) shift=10 ;;
+    esac
+    echo $(( num << shift ))
+}
+
+# 内核设备使用与libddriver相同的设备档案：内置档案名原样传入，档案文件展开为';'分隔的一行
+function profile_spec() {
+    local name
+    name=$(config_raw profile default)
+    [[ -f "$name" ]] || [[ -f "$ORIGIN_WORK_DIR/$name" ]] || { echo "$name"; return; }
+    [[ -f "$name" ]] || name="$ORIGIN_WORK_DIR/$name"
+    sed -e 's/#.*//' "$name" | tr '\n' ';'
+}
+
+# 在执行任何操作之前检查，避免擦除时镜像已截断却无法按设备大小扩展
+CONFIG_BLOCK_SZ=$(config_get io_sz 512) || exit 1
+CONFIG_DISK_SZ=$(config_get disk_sz 4M) || exit 1
+CONFIG_NODELAY=$(config_get nodelay 0) || exit 1
+if (( CONFIG_BLOCK_SZ <= 0 || CONFIG_DISK_SZ <= 0 )); then
+    echo "设备大小与IO单位必须为正: disk_sz=$CONFIG_DISK_SZ io_sz=$CONFIG_BLOCK_SZ" >&2
+    exit 1
+fi
+BLOCK_COUNT=$((CONFIG_DISK_SZ / CONFIG_BLOCK_SZ))
+# 内核设备一次读写可跨多个块，整盘拷贝按1M进行
+DD_BS=$CONFIG_BLOCK_SZ
+if (( CONFIG_DISK_SZ % 1048576 == 0 )); then
+    DD_BS=1048576
+fi
+DD_COUNT=$((CONFIG_DISK_SZ / DD_BS))
 
 
 function usage(){
@@ -38,6 +99,8 @@ function usage(){
     echo "-t            测试ddriver[请忽略]"
     echo "-d            导出ddriver至当前工作目录[PWD]"
     echo "-r            擦除ddriver"
+    echo "-s [file]     将ddriver保存为快照文件"
+    echo "-S [file]     将ddriver恢复为快照内容"
     echo "-l            显示ddriver的Log"
     echo "-v            显示ddriver的类型[内核模块 / 用户静态链接库]"
     echo "-h            打印本帮助菜单"
@@ -80,7 +143,8 @@ function install() {
         sudo rm $KERNEL_DEV_PATH>/dev/null 2>&1 
         sudo rmmod ddriver>/dev/null 2>&1 
         sudo dmesg -C
-        sudo insmod ./ddriver.ko
+        sudo insmod ./ddriver.ko disk_size="$CONFIG_DISK_SZ" profile="\"$(profile_spec)\"" \
+                                 nodelay="$CONFIG_NODELAY"
         in=$(dmesg | tail -n 1)
         tokens=("$in")
         major_number=${tokens[${#tokens[*]}-1]}
@@ -100,7 +164,7 @@ function install() {
         
         LAST_DIR=$PWD
         cd $USER_DDRIVER || exit
-        make all -f ./Makefile
+        make all replay snap -f ./Makefile
         
         mkdir -p bin
         
@@ -145,10 +209,16 @@ function dump(){
     sudo rm "$ORIGIN_WORK_DIR"/ddriver_dump>/dev/null 2>&1 
     if [ "$DDRIVER_TYPE" == "k" ]; then  
         echo "目标设备 $KERNEL_DEV_PATH"
-        sudo dd if=$KERNEL_DEV_PATH of="$ORIGIN_WORK_DIR"/ddriver_dump bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
+        sudo dd if=$KERNEL_DEV_PATH of="$ORIGIN_WORK_DIR"/ddriver_dump bs=$DD_BS count=$DD_COUNT
     else 
         echo "目标设备 $USER_DEV_PATH"
-        dd if="$USER_DEV_PATH" of="$ORIGIN_WORK_DIR"/ddriver_dump bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
+        if [ -f "$USER_DEV_PATH".cow ]; then
+            # 处于快照覆盖层时镜像不完整，经libddriver导出，需先卸载文件系统
+            $USER_SNAP_BIN -d "$USER_DEV_PATH" save "$ORIGIN_WORK_DIR"/ddriver_dump
+        else
+            # 直接读镜像，不占设备锁，挂载中也可导出
+            dd if="$USER_DEV_PATH" of="$ORIGIN_WORK_DIR"/ddriver_dump bs=$DD_BS count=$DD_COUNT
+        fi
     fi
     echo "文件已导出至$ORIGIN_WORK_DIR/ddriver_dump，请安装HexEditor插件查看其内容"
 }
@@ -156,13 +226,37 @@ function dump(){
 function clean(){
     if [ "$DDRIVER_TYPE" == "k" ]; then  
         echo "目标设备 $KERNEL_DEV_PATH"
-        sudo dd if=/dev/zero of=$KERNEL_DEV_PATH bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
+        sudo dd if=/dev/zero of=$KERNEL_DEV_PATH bs=$DD_BS count=$DD_COUNT
     else
         echo "目标设备 $USER_DEV_PATH"
-        dd if=/dev/zero of="$USER_DEV_PATH" bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
+        # 截断后再扩展为稀疏文件，耗时与设备大小无关
+        truncate -s 0 "$USER_DEV_PATH"
+        truncate -s "$CONFIG_DISK_SZ" "$USER_DEV_PATH"
+        rm -f "$USER_DEV_PATH".cow
     fi 
 }
 
+# 快照：用户设备优先reflink，不支持时以写时复制覆盖层恢复；内核设备只能整盘复制
+function snapshot(){
+    local file=$1
+    [[ "$file" != /* ]] && file="$ORIGIN_WORK_DIR/$file"
+    if [ "$DDRIVER_TYPE" == "k" ]; then  
+        sudo dd if=$KERNEL_DEV_PATH of="$file" bs=$DD_BS count=$DD_COUNT
+    else
+        $USER_SNAP_BIN -d "$USER_DEV_PATH" save "$file"
+    fi
+}
+
+function restore(){
+    local file=$1
+    [[ "$file" != /* ]] && file="$ORIGIN_WORK_DIR/$file"
+    if [ "$DDRIVER_TYPE" == "k" ]; then  
+        sudo dd if="$file" of=$KERNEL_DEV_PATH bs=$DD_BS count=$DD_COUNT
+    else
+        $USER_SNAP_BIN -d "$USER_DEV_PATH" restore "$file"
+    fi
+}
+
 function version () {
     if [ "$DDRIVER_TYPE" == "k" ]; then  
         echo "内核设备: $KERNEL_DEV_PATH"
@@ -174,7 +268,7 @@ function version () {
 if [ $# == 0 ]; then
     usage
 else 
-    while getopts 'i:tdhrlv' OPT; do
+    while getopts 'i:tdhrlvs:S:' OPT; do
         case $OPT in
             i) install "$OPTARG"
             ;;
@@ -184,6 +278,10 @@ else
             ;;
             r) clean
             ;;
+            s) snapshot "$OPTARG"
+            ;;
+            S) restore "$OPTARG"
+            ;;
             l) log
             ;;
             v) version 
@@ -4,7 +4,30 @@
 #include <linux/fs.h>
 #include <asm/uaccess.h>
 #include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/vmalloc.h>
+#include <linux/moduleparam.h>
+#include <linux/uio.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/version.h>
+#include <linux/eventfd.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/err.h>
+#include <linux/hrtimer.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/sched/signal.h>
+#include <linux/random.h>
+#include <linux/string.h>
 #include "ddriver_ctl.h"
+#include "ddriver_profiles.h"
 /******************************************************************************
 * SECTION: Macro definitions
 *******************************************************************************/
@@ -27,8 +50,11 @@
                         "filp_open/cpp-filp_open-function-examples.html>"
 #define DRIVER_VERSION  "0.1.0"
 
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
+#define CONFIG_DISK_SZ  "4M"                          /* Default of the disk_size parameter */
 #define CONFIG_BLOCK_SZ (512)
+#define CONFIG_TRACK_NUM (100)
+#define PROFILE_SLOW_MAX  8                           /* Slow regions at most */
+#define PROFILE_STEPS     16                          /* Interpolation points per quantile segment */
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
@@ -36,14 +62,29 @@
 #define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
 #define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
 
-#define GET_HEAD_POS(disk)      (disk.head - disk.layout)
-#define FORWARD_HEAD(disk, dis) (disk.head += dis)
-#define SET_HEAD(disk, ofs)     (disk.head = disk.layout + ofs)
-#define RESET_HEAD(disk)        (SET_HEAD(disk, 0))
+#define GET_HEAD_POS(f)         (READ_ONCE((f)->head))
+#define SET_HEAD(f, ofs)        (WRITE_ONCE((f)->head, ofs))
+#define RESET_HEAD(f)           (SET_HEAD(f, 0))
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+#define INC_READCNT(st)         ((st)->reads++)
+#define INC_WRITECNT(st)        ((st)->writes++)
+#define INC_SEEKCNT(st)         ((st)->seeks++)
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+#define EVENTFD_SIGNAL(ctx)     eventfd_signal(ctx)
+#else
+#define EVENTFD_SIGNAL(ctx)     eventfd_signal(ctx, 1)
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+#define HRTIMER_SETUP(timer, fn, mode)  hrtimer_setup(timer, fn, CLOCK_MONOTONIC, mode)
+#else
+#define HRTIMER_SETUP(timer, fn, mode)                                  \
+	do {                                                                \
+		hrtimer_init(timer, CLOCK_MONOTONIC, mode);                     \
+		(timer)->function = fn;                                         \
+	} while(0)
+#endif
 /******************************************************************************
 * SECTION: Kernel Module Template
 *******************************************************************************/
@@ -51,61 +92,513 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR(DRIVER_AUTHOR);	    
 MODULE_DESCRIPTION(DRIVER_DESC);	
 MODULE_VERSION(DRIVER_VERSION);	
+
+static char *disk_size = CONFIG_DISK_SZ;
+module_param(disk_size, charp, 0444);
+MODULE_PARM_DESC(disk_size, "Disk size with K/M/G suffix, a multiple of the block size (default " 
+                            CONFIG_DISK_SZ ")");
+
+static char *profile = "default";
+module_param(profile, charp, 0444);
+MODULE_PARM_DESC(profile, "Builtin profile name, or 'key = value; ...' in the user driver's "
+                          "profile format applied on top of default");
+
+static bool nodelay = false;
+module_param(nodelay, bool, 0644);
+MODULE_PARM_DESC(nodelay, "Account the modeled latency without waiting for it");
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
+struct ddriver_file                                   /* Per open file, in file->private_data */
+{
+    loff_t head;                                      /* Disk Head, where the last access ended */
+    atomic64_t batch_done;                            /* Async batches completed, not yet reaped */
+    struct list_head pending;                         /* Async batches whose timer has not fired */
+    spinlock_t pending_lock;                          /* Guards pending, taken by the timer softirq */
+    wait_queue_head_t wait;                           /* Pollers waiting for batch_done */
+};
+
+struct ddriver_pending                                /* An async batch waiting for its completion time */
+{
+    struct hrtimer timer;
+    struct list_head node;                            /* On f->pending, whoever unlinks it owns it */
+    struct ddriver_file *f;
+    struct eventfd_ctx *efd;
+};
+
+struct ddriver_lat_dist
+{
+    u32 p50;
+    u32 p99;
+    u32 p999;
+};
+
+/**
+ * Same quantile function as the user driver, in ns and fixed point: four 
+ * segments [0, .5) [.5, .99) [.99, .999) [.999, 1) mapping to p50/2 -> p50 -> 
+ * p99 -> p999 -> p999 * p999 / p99, log-linear inside each segment
+ */
+struct lat_table
+{
+    int fixed;
+    u64 point[4][PROFILE_STEPS + 1];
+};
+
+struct slow_region
+{
+    loff_t start;
+    loff_t end;
+    int    factor;
+};
+
+struct ddriver_profile
+{
+    struct ddriver_lat_dist read_lat;                 /* Latencies in us as in the profile */
+    struct ddriver_lat_dist write_lat;
+    u32  seek_lat;
+    u32  stroke_lat;
+    u32  rot_lat;
+    u64  bandwidth;
+    u64  xfer_ns;                                     /* Per block transfer */
+    struct lat_table read;
+    struct lat_table write;
+    int  nr_slow;
+    struct slow_region slow[PROFILE_SLOW_MAX];
+};
+
+struct builtin_profile
+{
+    const char *name;
+    const char *spec;
+};
+
 struct ddriver
 {
-    char layout[CONFIG_DISK_SZ];                      /* Disk Layout */
-    char *head;                                       /* Disk Head */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
+    char *layout;                                     /* Disk Layout, vmalloc'ed by disk_size */
     int  major_num;
-    int  open_count;
-    int  layout_size;
+    atomic_t open_count;
+    loff_t layout_size;
     int  iounit_size;
+    struct ddriver_regions regions;                   /* Layout for per-region stats */
+    struct ddriver_stats __percpu *stats;             /* Counters per CPU, summed on query */
+    atomic64_t arm;                                   /* Where the one physical arm rests, for the spindle model */
+    atomic64_t clock_ns;                              /* Modeled device time, sum of all latencies */
 };
 
 static struct ddriver disk = {
-    .head        = NULL,
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
+    .layout      = NULL,
     .major_num   = 0,
-    .open_count  = 0,
-    .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
+    .open_count  = ATOMIC_INIT(0),
+    .layout_size = 0,
+    .iounit_size = CONFIG_BLOCK_SZ,
+    .stats       = NULL,
+    .arm         = ATOMIC64_INIT(0),
+    .clock_ns    = ATOMIC64_INIT(0)
+};
+
+static DEFINE_MUTEX(ctl_lock);                        /* Serializes regions and stats reset */
+
+static const struct builtin_profile builtins[] = {
+    DDRIVER_BUILTIN_PROFILES
 };
+
+static struct ddriver_profile prof;
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
-int check_valid(size_t size){
-    if (GET_HEAD_POS(disk) >=  CONFIG_DISK_SZ) {
-        kernel_alert("disk head reach the end");
+int check_range(loff_t offset, size_t size){
+    if (!IS_ADDR_ALIGN(offset) || size % CONFIG_BLOCK_SZ != 0) {
+        kernel_alert("access [%lld, +%zu) should align to %d", offset, size, CONFIG_BLOCK_SZ);
+        return -EINVAL;
+    }
+    if (offset < 0 || offset > disk.layout_size - (loff_t)size) {
+        kernel_alert("access [%lld, +%zu) out of disk range", offset, size);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void account_seek(struct ddriver_stats *st, loff_t from, loff_t to) {
+    INC_SEEKCNT(st);
+    st->seek_distance += to > from ? to - from : from - to;
+}
+
+/* Runs on the local CPU with preemption off, see get_cpu_ptr */
+static void account_rw(struct ddriver_stats *st, int is_write, loff_t offset, size_t size, 
+                       u64 lat_us, int sequential) {
+    loff_t end = offset + size;
+    int nr = READ_ONCE(disk.regions.nr);
+    int i;
+
+    if (sequential)
+        st->seq_accesses++;
+    else
+        st->rand_accesses++;
+    if (is_write) {
+        INC_WRITECNT(st);
+        st->bytes_written += size;
+    } else {
+        INC_READCNT(st);
+        st->bytes_read += size;
+    }
+    st->lat_total_us += lat_us;
+    st->lat_hist[min_t(int, fls64(lat_us), DDRIVER_LAT_BUCKETS - 1)]++;
+    if (lat_us > st->lat_max_us)
+        st->lat_max_us = lat_us;
+
+    for (i = 0; i < nr; i++) {                        /* A racing REGIONS only misfiles this one */
+        struct ddriver_region_stats *rs = &st->region[i];
+        loff_t lo = max_t(loff_t, offset, disk.regions.region[i].start);
+        loff_t hi = min_t(loff_t, end, disk.regions.region[i].end);
+        if (lo >= hi)
+            continue;
+        if (is_write) {
+            rs->writes++;
+            rs->bytes_written += hi - lo;
+        } else {
+            rs->reads++;
+            rs->bytes_read += hi - lo;
+        }
+    }
+}
+
+/* Sum the per-CPU counters into @out, readers may see an access half counted */
+static void collect_stats(struct ddriver_stats *out) {
+    int cpu, i;
+
+    memset(out, 0, sizeof(struct ddriver_stats));
+    for_each_possible_cpu(cpu) {
+        struct ddriver_stats *st = per_cpu_ptr(disk.stats, cpu);
+        out->reads         += st->reads;
+        out->writes        += st->writes;
+        out->seeks         += st->seeks;
+        out->bytes_read    += st->bytes_read;
+        out->bytes_written += st->bytes_written;
+        out->seq_accesses  += st->seq_accesses;
+        out->rand_accesses += st->rand_accesses;
+        out->seek_distance += st->seek_distance;
+        out->lat_total_us  += st->lat_total_us;
+        out->lat_max_us     = max(out->lat_max_us, st->lat_max_us);
+        for (i = 0; i < DDRIVER_LAT_BUCKETS; i++)
+            out->lat_hist[i] += st->lat_hist[i];
+        for (i = 0; i < DDRIVER_REGION_MAX; i++) {
+            out->region[i].reads         += st->region[i].reads;
+            out->region[i].writes        += st->region[i].writes;
+            out->region[i].bytes_read    += st->region[i].bytes_read;
+            out->region[i].bytes_written += st->region[i].bytes_written;
+        }
+    }
+    out->version = DDRIVER_STATS_VERSION;
+    out->size = sizeof(struct ddriver_stats);
+    out->nr_regions = disk.regions.nr;
+    for (i = 0; i < disk.regions.nr; i++)
+        out->region[i].region = disk.regions.region[i];
+}
+
+/* Account one finished access of @f, the head moves to its end */
+static void account_access(struct ddriver_file *f, int is_write, loff_t pos, size_t size, 
+                           u64 lat_us) {
+    struct ddriver_stats *st;
+    loff_t from = GET_HEAD_POS(f);
+
+    SET_HEAD(f, pos + size);
+    st = get_cpu_ptr(disk.stats);
+    if (pos != from)
+        account_seek(st, from, pos);
+    account_rw(st, is_write, pos, size, lat_us, pos == from);
+    put_cpu_ptr(disk.stats);
+}
+
+/* Clear counters only, the layout and disk content are kept. Called under ctl_lock */
+static void reset_stats(void) {
+    int cpu;
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(disk.stats, cpu), 0, sizeof(struct ddriver_stats));
+}
+/******************************************************************************
+* SECTION: Device Profile
+*******************************************************************************/
+/* Integer square root by Newton's method */
+static u64 profile_sqrt(u64 x) {
+    u64 r = x, y = x / 2 + 1;
+
+    if (x < 2)
+        return x;
+    while (y < r) {
+        r = y;
+        y = (r + div64_u64(x, r)) / 2;
+    }
+    return r;
+}
+
+/* Geometric points between a and b, the ratio is the 16th root of b / a in Q16 */
+static void profile_segment(u64 *point, u64 a, u64 b) {
+    u64 ratio = div64_u64(b << 16, a);
+    int i;
+
+    for (i = 0; i < 4; i++)
+        ratio = profile_sqrt(ratio << 16);
+    point[0] = a;
+    for (i = 1; i <= PROFILE_STEPS; i++)
+        point[i] = (point[i - 1] * ratio) >> 16;
+    point[PROFILE_STEPS] = b;
+}
+
+static void profile_build(struct lat_table *t, const struct ddriver_lat_dist *d) {
+    u64 p50  = (u64)max_t(u32, d->p50, 1) * NSEC_PER_USEC;
+    u64 p99  = (u64)max_t(u32, d->p99, 1) * NSEC_PER_USEC;
+    u64 p999 = (u64)max_t(u32, d->p999, 1) * NSEC_PER_USEC;
+
+    t->fixed = d->p99 == d->p50 && d->p999 == d->p50;
+    if (t->fixed)
+        return;
+    profile_segment(t->point[0], p50 / 2, p50);
+    profile_segment(t->point[1], p50, p99);
+    profile_segment(t->point[2], p99, p999);
+    profile_segment(t->point[3], p999, div64_u64(p999 * max_t(u32, d->p999, 1), 
+                                                 max_t(u32, d->p99, 1)));
+}
+
+/* Draw one request overhead in ns */
+static u64 profile_sample(const struct lat_table *t, const struct ddriver_lat_dist *d) {
+    static const u32 bound[5] = { 0, 500000, 990000, 999000, 1000000 };
+    u32 u, f;
+    int seg, i;
+
+    if (t->fixed)
+        return (u64)d->p50 * NSEC_PER_USEC;
+    u = (u32)(((u64)get_random_u32() * 1000000) >> 32);
+    for (seg = 0; seg < 3 && u >= bound[seg + 1]; seg++)
+        ;
+    f = (u32)div_u64((u64)(u - bound[seg]) * PROFILE_STEPS * 1024, bound[seg + 1] - bound[seg]);
+    i = f >> 10;
+    f &= 1023;
+    if (i >= PROFILE_STEPS)
+        return t->point[seg][PROFILE_STEPS];
+    return t->point[seg][i] + (((t->point[seg][i + 1] - t->point[seg][i]) * f) >> 10);
+}
+
+static int profile_parse_dist(struct ddriver_lat_dist *d, const char *val) {
+    char *end;
+    u32 p[3];
+    int nr = 0;
+
+    while (nr < 3) {
+        val = skip_spaces(val);
+        while (*val == ',')
+            val = skip_spaces(val + 1);
+        if (*val == '\0')
+            break;
+        p[nr++] = (u32)simple_strtoul(val, &end, 0);
+        if (end == val)
+            return -EINVAL;
+        val = end;
+    }
+    if (nr == 0)
+        return -EINVAL;
+    d->p50  = p[0];
+    d->p99  = nr > 1 ? p[1] : d->p50;
+    d->p999 = nr > 2 ? p[2] : d->p99;
+    return d->p50 <= d->p99 && d->p99 <= d->p999 ? 0 : -EINVAL;
+}
+
+/* start length factor, separated by spaces or ':' */
+static int profile_parse_slow(char *val) {
+    struct slow_region *r;
+    char *end;
+
+    if (prof.nr_slow == PROFILE_SLOW_MAX)
+        return -ENOSPC;
+    r = &prof.slow[prof.nr_slow];
+    r->start = memparse(val, &end);
+    val = end + strspn(end, " :\t");
+    r->end = r->start + memparse(val, &end);
+    val = end + strspn(end, " :\t");
+    r->factor = (int)simple_strtol(val, &end, 0);
+    if (end == val || r->factor < 1 || r->end <= r->start)
         return -EINVAL;
+    prof.nr_slow++;
+    return 0;
+}
+
+static int profile_set(const char *key, char *val) {
+    if (strcmp(key, "read_lat") == 0)
+        return profile_parse_dist(&prof.read_lat, val);
+    if (strcmp(key, "write_lat") == 0)
+        return profile_parse_dist(&prof.write_lat, val);
+    if (strcmp(key, "seek_lat") == 0)
+        return kstrtou32(val, 0, &prof.seek_lat);
+    if (strcmp(key, "stroke_lat") == 0)
+        return kstrtou32(val, 0, &prof.stroke_lat);
+    if (strcmp(key, "rot_lat") == 0)
+        return kstrtou32(val, 0, &prof.rot_lat);
+    if (strcmp(key, "bandwidth") == 0) {
+        prof.bandwidth = memparse(val, NULL);
+        return 0;
     }
-    if (size != CONFIG_BLOCK_SZ){
-        kernel_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
-        return -EIO;
+    if (strcmp(key, "slow") == 0)
+        return profile_parse_slow(val);
+    return -ENOENT;
+}
+
+static int profile_parse(const char *spec) {
+    char *text = kstrdup(spec, GFP_KERNEL);
+    char *rest = text, *item, *eq, *key;
+    int ret = 0;
+
+    if (text == NULL)
+        return -ENOMEM;
+    while (ret == 0 && (item = strsep(&rest, ";\n")) != NULL) {
+        if ((eq = strchr(item, '#')) != NULL)
+            *eq = '\0';
+        key = strim(item);
+        if (*key == '\0')
+            continue;
+        eq = strchr(key, '=');
+        if (eq == NULL) {
+            kernel_alert("bad profile item [%s]", key);
+            ret = -EINVAL;
+            break;
+        }
+        *eq = '\0';
+        key = strim(key);
+        ret = profile_set(key, strim(eq + 1));
+        if (ret < 0)
+            kernel_alert("bad profile item [%s], ret %d", key, ret);
+    }
+    kfree(text);
+    return ret;
+}
+
+/**
+ * @brief Load a builtin profile by name, or a spec in the user driver's format 
+ *        on top of default. Keys the profile leaves out keep the default
+ * 
+ * @param name          
+ * @return int          0 on success
+ */
+static int profile_load(const char *name) {
+    const char *spec = NULL;
+    int ret, i;
+
+    for (i = 0; builtins[i].name != NULL; i++) {
+        if (strcmp(builtins[i].name, name) == 0)
+            spec = builtins[i].spec;
+    }
+    if (spec == NULL && strchr(name, '=') == NULL) {
+        kernel_alert("unknown profile [%s]", name);
+        return -ENOENT;
+    }
+    memset(&prof, 0, sizeof(struct ddriver_profile));
+    ret = profile_parse(builtins[0].spec);
+    if (ret == 0)
+        ret = profile_parse(spec ? spec : name);
+    if (ret < 0)
+        return ret;
+    if (prof.bandwidth == 0) {
+        kernel_alert("profile needs a bandwidth");
+        return -EINVAL;
     }
+    prof.xfer_ns = div64_u64((u64)CONFIG_BLOCK_SZ * NSEC_PER_SEC, prof.bandwidth);
+    profile_build(&prof.read, &prof.read_lat);
+    profile_build(&prof.write, &prof.write_lat);
+    kernel_info("profile %s: read %u/%u/%u us, write %u/%u/%u us (p50/p99/p999), "
+                "%llu MB/s, %d slow regions", spec ? name : "custom",
+                prof.read_lat.p50, prof.read_lat.p99, prof.read_lat.p999,
+                prof.write_lat.p50, prof.write_lat.p99, prof.write_lat.p999,
+                div64_u64(prof.bandwidth, 1000000), prof.nr_slow);
     return 0;
 }
+
+/* Seek plus rotation from one byte offset to another in us, as emulate_spindle_lat */
+static u64 emulate_spindle_lat(u64 from, u64 to) {
+    u64 per_track = div64_u64(disk.layout_size, CONFIG_TRACK_NUM);
+    u64 from_track, to_track, distance, angle, target;
+    u64 rot = prof.rot_lat;
+    s64 seek = 0;
+
+    if (from == to || rot == 0 || per_track == 0)
+        return 0;                                     /* No moving parts, no positioning */
+    from_track = div64_u64(from, per_track);
+    to_track   = div64_u64(to, per_track);
+    distance   = from_track > to_track ? from_track - to_track : to_track - from_track;
+    if (distance != 0) {
+        seek = prof.seek_lat;
+        if (CONFIG_TRACK_NUM > 1)
+            seek += div64_s64(((s64)prof.stroke_lat - prof.seek_lat) * (s64)distance, 
+                              CONFIG_TRACK_NUM - 1);
+    }
+    angle  = div64_u64((from - from_track * per_track) * rot, per_track);
+    div64_u64_rem(angle + seek, rot, &angle);
+    target = div64_u64((to - to_track * per_track) * rot, per_track);
+    target = target + rot - angle;
+    return seek + (target >= rot ? target - rot : target);
+}
+
+static int profile_slow(loff_t offset, size_t size) {
+    int factor = 1;
+    int i;
+
+    for (i = 0; i < prof.nr_slow; i++) {
+        if (offset < prof.slow[i].end && offset + (loff_t)size > prof.slow[i].start &&
+            prof.slow[i].factor > factor)
+            factor = prof.slow[i].factor;
+    }
+    return factor;
+}
+
+/**
+ * @brief Modeled service time of one access: positioning of the physical arm, 
+ *        request overhead drawn from the profile, and transfer per block, 
+ *        scaled inside slow regions. The same as emulate_access_lat of the 
+ *        user driver on a single disk
+ * 
+ * @param is_write      
+ * @param pos           
+ * @param size          
+ * @return u64          Latency in ns
+ */
+static u64 emulate_access_ns(int is_write, loff_t pos, size_t size) {
+    u64 from = atomic64_xchg(&disk.arm, pos + size);
+    u64 ns;
+
+    ns  = emulate_spindle_lat(from, pos) * NSEC_PER_USEC;
+    ns += is_write ? profile_sample(&prof.write, &prof.write_lat) 
+                   : profile_sample(&prof.read, &prof.read_lat);
+    ns += (u64)(size / CONFIG_BLOCK_SZ) * prof.xfer_ns;
+    ns *= profile_slow(pos, size);
+    atomic64_add(ns, &disk.clock_ns);
+    return ns;
+}
+
+/* Sleep on an hrtimer until @expires, the CPU is free meanwhile */
+static void device_wait(ktime_t expires) {
+    if (nodelay)
+        return;
+    while (ktime_before(ktime_get(), expires) && !fatal_signal_pending(current)) {
+        set_current_state(TASK_KILLABLE);
+        schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+    }
+}
 /******************************************************************************
 * SECTION: Function definitions
 *******************************************************************************/
 static int      device_open(struct inode *, struct file *);
 static int      device_release(struct inode *, struct file *);
-static ssize_t  device_read(struct file *, char *, size_t, loff_t *);
-static ssize_t  device_write(struct file *, const char *, size_t, loff_t *);
+static ssize_t  device_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t  device_write_iter(struct kiocb *, struct iov_iter *);
+static int      device_mmap(struct file *, struct vm_area_struct *);
+static __poll_t device_poll(struct file *, poll_table *);
 static loff_t   device_seek(struct file *, loff_t, int);
 static long     device_ioctl(struct file *, unsigned int, unsigned long);
 /******************************************************************************
 * SECTION: Global var or structure definitions
 *******************************************************************************/
 static struct file_operations file_ops = {
-    .read = device_read,
-    .write = device_write,
+    .read_iter = device_read_iter,
+    .write_iter = device_write_iter,
+    .mmap = device_mmap,
+    .poll = device_poll,
     .open = device_open,
     .llseek = device_seek,
     .unlocked_ioctl = device_ioctl,
@@ -115,61 +608,111 @@ static struct file_operations file_ops = {
 * SECTION: Function Implementation
 *******************************************************************************/
 /**
- * @brief Disk Read
+ * @brief Copy between the disk and the iterator at iocb->ki_pos. Any multiple of 
+ *        the block size is served in one call; read()/write() use the file 
+ *        position, pread()/pwrite()/readv()/writev() come here the same way. 
+ *        Every open file has its own head: an access that starts elsewhere than 
+ *        where the previous access of the same file ended counts as a seek. 
+ *        The call returns once the latency modeled by the profile has passed
  * 
- * @param file          Ignored
- * @param user_buffer   User space buffer
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
- * @param offset        Ignored
- * @return ssize_t      Bytes have been read 
+ * @param iocb          Position in ki_pos, advanced by the bytes copied
+ * @param iter          User buffers
+ * @param is_write      
+ * @return ssize_t      Bytes copied
  */
 static ssize_t 
-device_read(struct file *file, char *user_buffer, size_t size, loff_t *offset) {
-    IGNORE_ARG(offset);
-    IGNORE_ARG(file);
-    int res = check_valid(size);
-    if(res < 0)
+device_rw_iter(struct kiocb *iocb, struct iov_iter *iter, int is_write) {
+    struct ddriver_file *f = iocb->ki_filp->private_data;
+    size_t size = iov_iter_count(iter);
+    loff_t pos = iocb->ki_pos;
+    size_t done;
+    ktime_t start;
+    u64 ns;
+    int res;
+
+    if (size == 0)
+        return 0;
+    res = check_range(pos, size);
+    if (res < 0)
         return res;
-    if (copy_to_user(user_buffer, disk.head, CONFIG_BLOCK_SZ))
+
+    start = ktime_get();
+    if (is_write)                                     /* Copy may fault, keep it preemptible */
+        done = copy_from_iter(disk.layout + pos, size, iter);
+    else
+        done = copy_to_iter(disk.layout + pos, size, iter);
+    if (done != size)                                 /* Failed requests move no arm, take no time */
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    ns = emulate_access_ns(is_write, pos, size);
+    account_access(f, is_write, pos, size, div_u64(ns, NSEC_PER_USEC));
+    device_wait(ktime_add_ns(start, ns));             /* The copy overlaps the modeled latency */
+    iocb->ki_pos = pos + size;
+    return size;
+}
+/**
+ * @brief Disk Read
+ * 
+ * @param iocb          Position in ki_pos, aligned to @CONFIG_BLOCK_SZ
+ * @param to            User buffers, a multiple of @CONFIG_BLOCK_SZ in total
+ * @return ssize_t      Bytes have been read 
+ */
+static ssize_t 
+device_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    return device_rw_iter(iocb, to, 0);
 }
 /**
  * @brief Disk Write
  * 
- * @param file          Ignored
- * @param user_buffer   User space buffer, copy content from
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
- * @param offset        Ignored
+ * @param iocb          Position in ki_pos, aligned to @CONFIG_BLOCK_SZ
+ * @param from          User buffers, copy content from
  * @return ssize_t      Bytes have been written
  */
 static ssize_t 
-device_write(struct file *file, const char *user_buffer, size_t size, loff_t *offset) {
-    IGNORE_ARG(offset);
+device_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    return device_rw_iter(iocb, from, 1);
+}
+/**
+ * @brief Disk mmap, maps the disk pages directly. Accesses through the mapping 
+ *        bypass the counters, like ddriver_map of the user driver
+ * 
+ * @param file          Ignored
+ * @param vma           Offset in vm_pgoff, must lie inside the disk
+ * @return int          state
+ */
+static int 
+device_mmap(struct file *file, struct vm_area_struct *vma) {
+    loff_t offset = (loff_t)vma->vm_pgoff << PAGE_SHIFT;
     IGNORE_ARG(file);
-    int res = check_valid(size);
-    if(res < 0)
-        return res;
 
-    if (copy_from_user(disk.head, user_buffer, CONFIG_BLOCK_SZ))
-        return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    if (offset + (loff_t)(vma->vm_end - vma->vm_start) > PAGE_ALIGN(disk.layout_size))
+        return -EINVAL;
+    return remap_vmalloc_range(vma, disk.layout, vma->vm_pgoff);
+}
+/**
+ * @brief Disk poll, readable while async batches have completed but are not 
+ *        reaped by IOC_REQ_DEVICE_REAP
+ * 
+ * @param file          
+ * @param wait          
+ * @return __poll_t     EPOLLIN when completions are pending
+ */
+static __poll_t 
+device_poll(struct file *file, poll_table *wait) {
+    struct ddriver_file *f = file->private_data;
+
+    poll_wait(file, &f->wait, wait);
+    return atomic64_read(&f->batch_done) ? EPOLLIN | EPOLLRDNORM : 0;
 }
 /**
  * @brief Disk Seek
  * 
  * @param file          Ignored
  * @param offset        Aligned to @CONFIG_BLOCK_SZ
- * @param whence        SEEK_CUR, SEEK_SET
+ * @param whence        SEEK_SET, SEEK_CUR, SEEK_END
  * @return loff_t       cur pos
  */
 static loff_t 
 device_seek(struct file *file, loff_t offset, int whence) {
-    IGNORE_ARG(file);
     if (!IS_ADDR_ALIGN(offset)) {
         kernel_alert("offset %lld must be aligned to block size %d", 
                       offset, CONFIG_BLOCK_SZ);
@@ -178,50 +721,320 @@ device_seek(struct file *file, loff_t offset, int whence) {
     switch (whence)
     {
     case SEEK_SET:
-        SET_HEAD(disk, offset);
         break;
     case SEEK_CUR:
-        FORWARD_HEAD(disk, offset);
+        offset += file->f_pos;
+        break;
+    case SEEK_END:
+        offset += disk.layout_size;
         break;
     default:
+        return -EINVAL;
+    }
+    if (offset < 0 || offset > disk.layout_size) {
+        kernel_alert("offset %lld out of disk range", offset);
+        return -EINVAL;
+    }
+    file->f_pos = offset;                             /* The head moves on the next access */
+    return offset;
+}
+/**
+ * @brief Run one batch descriptor with the same checks and accounting as 
+ *        read_iter/write_iter. Memory needs no flush, so FUA is a plain write
+ * 
+ * @param f             Its head moves like a read or write of this file
+ * @param desc          
+ * @param ns            Modeled latency is added here, the caller waits for it
+ * @return int          Bytes transferred, or -errno
+ */
+static int 
+device_do_desc(struct ddriver_file *f, const struct ddriver_iodesc *desc, u64 *ns) {
+    void __user *buf = u64_to_user_ptr(desc->buf);
+    loff_t pos = (loff_t)desc->offset;
+    size_t size = desc->length;
+    unsigned long left;
+    u64 lat;
+    int is_write;
+    int res;
+
+    switch (desc->op)
+    {
+    case DDRIVER_OP_READ:
+        is_write = 0;
         break;
+    case DDRIVER_OP_WRITE:
+    case DDRIVER_OP_WRITE_FUA:
+        is_write = 1;
+        break;
+    default:                                          /* No discard, see TOPOLOGY */
+        return -EOPNOTSUPP;
+    }
+    if (desc->length > MAX_RW_COUNT)
+        return -EINVAL;
+    res = check_range(pos, size);
+    if (res < 0 || size == 0)
+        return res;
+
+    if (is_write)
+        left = copy_from_user(disk.layout + pos, buf, size);
+    else
+        left = copy_to_user(buf, disk.layout + pos, size);
+    if (left)                                         /* Counted only once copied, as device_rw_iter */
+        return -EFAULT;
+    lat = emulate_access_ns(is_write, pos, size);
+    account_access(f, is_write, pos, size, div_u64(lat, NSEC_PER_USEC));
+    *ns += lat;
+    return size;
+}
+/**
+ * @brief Mark an async batch done: wake pollers and signal its eventfd
+ * 
+ * @param f             
+ * @param efd           Dropped here, may be NULL
+ */
+static void 
+complete_batch(struct ddriver_file *f, struct eventfd_ctx *efd) {
+    atomic64_inc(&f->batch_done);
+    wake_up_interruptible(&f->wait);
+    if (efd) {
+        EVENTFD_SIGNAL(efd);
+        eventfd_ctx_put(efd);
+    }
+}
+/* Softirq context, the pending batch frees itself unless release took it first */
+static enum hrtimer_restart 
+batch_timer_fn(struct hrtimer *timer) {
+    struct ddriver_pending *p = container_of(timer, struct ddriver_pending, timer);
+    struct ddriver_file *f = p->f;
+    bool owned;
+
+    spin_lock(&f->pending_lock);
+    owned = !list_empty(&p->node);
+    if (owned) {
+        list_del_init(&p->node);
+        complete_batch(f, p->efd);                    /* f may be released once unlocked */
+    }
+    spin_unlock(&f->pending_lock);
+    if (owned)
+        kfree(p);
+    return HRTIMER_NORESTART;
+}
+/**
+ * @brief Complete an async batch from a softirq hrtimer at @expires, nobody 
+ *        blocks meanwhile. Falls back to completing now without memory
+ * 
+ * @param f             Release completes its pending batches early
+ * @param efd           
+ * @param expires       
+ */
+static void 
+queue_batch(struct ddriver_file *f, struct eventfd_ctx *efd, ktime_t expires) {
+    struct ddriver_pending *p = NULL;
+
+    if (!nodelay)
+        p = kmalloc(sizeof(struct ddriver_pending), GFP_KERNEL);
+    if (p == NULL) {
+        complete_batch(f, efd);
+        return;
+    }
+    p->f   = f;
+    p->efd = efd;
+    HRTIMER_SETUP(&p->timer, batch_timer_fn, HRTIMER_MODE_ABS_SOFT);
+    spin_lock_bh(&f->pending_lock);
+    list_add_tail(&p->node, &f->pending);
+    spin_unlock_bh(&f->pending_lock);
+    hrtimer_start(&p->timer, expires, HRTIMER_MODE_ABS_SOFT);
+}
+/**
+ * @brief Run a batch of descriptors in one kernel entry, writing each result 
+ *        back to its res. The modeled latencies of the descriptors add up as if 
+ *        issued one after another: a sync batch returns after that time, an 
+ *        async batch returns at once and completes through poll and its 
+ *        eventfd when the time has passed, so batches may complete out of 
+ *        order. Data is copied in the ioctl, buffers may be reused at once
+ * 
+ * @param f             
+ * @param ubatch        
+ * @return long         Number of descriptors that succeeded, or -errno
+ */
+static long 
+device_batch(struct ddriver_file *f, struct ddriver_batch __user *ubatch) {
+    struct ddriver_batch batch;
+    struct ddriver_iodesc *descs;
+    struct eventfd_ctx *efd = NULL;
+    ktime_t start = ktime_get();
+    u64 ns = 0;
+    size_t len;
+    long ok = 0;
+    u32 i;
+
+    if (copy_from_user(&batch, ubatch, sizeof(struct ddriver_batch)))
+        return -EFAULT;
+    if (batch.nr > DDRIVER_BATCH_MAX || (batch.flags & ~DDRIVER_BATCH_ASYNC))
+        return -EINVAL;
+    len = batch.nr * sizeof(struct ddriver_iodesc);
+    descs = memdup_user(u64_to_user_ptr(batch.descs), len);
+    if (IS_ERR(descs))
+        return PTR_ERR(descs);
+    if ((batch.flags & DDRIVER_BATCH_ASYNC) && batch.eventfd >= 0) {
+        efd = eventfd_ctx_fdget(batch.eventfd);
+        if (IS_ERR(efd)) {
+            kfree(descs);
+            return PTR_ERR(efd);
+        }
     }
-    INC_SEEKCNT(disk);
-    return GET_HEAD_POS(disk);
+
+    for (i = 0; i < batch.nr; i++) {
+        descs[i].res = device_do_desc(f, &descs[i], &ns);
+        if (descs[i].res >= 0)
+            ok++;
+    }
+    if (copy_to_user(u64_to_user_ptr(batch.descs), descs, len))
+        ok = -EFAULT;
+    kfree(descs);
+    if (batch.flags & DDRIVER_BATCH_ASYNC)
+        queue_batch(f, efd, ktime_add_ns(start, ns));
+    else
+        device_wait(ktime_add_ns(start, ns));
+    return ok;
+}
+/* Where transfer time matches the p50 read overhead, as the user driver reports */
+static u32 
+optimal_io_size(u32 max_transfer) {
+    u64 units = prof.xfer_ns ? div64_u64((u64)prof.read_lat.p50 * NSEC_PER_USEC, prof.xfer_ns) : 1;
+    u32 opt = disk.iounit_size;
+
+    while (opt < units * disk.iounit_size && opt < max_transfer)
+        opt <<= 1;
+    return opt;
 }
 /**
  * @brief Disk ioctl
  * 
- * @param file          Ignored
+ * @param file          RESET, BATCH and REAP act on this file only
  * @param cmd           Command
  * @param arg           Args
  * @return long         State
  */
 static long 
 device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
-    IGNORE_ARG(file);
     int ret;
+    struct ddriver_stats *stats;
     struct ddriver_state state;
+    struct ddriver_geometry geo;
+    struct ddriver_regions regions;
+    struct ddriver_topology topo;
+    __u64 size64;
+    int size;
+    int i;
     switch (cmd)
     {
-    case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        ret = copy_to_user((int __user *)arg, &disk.layout_size, sizeof(int));
+    case IOC_REQ_DEVICE_SIZE:                         /* Device Size, use SIZE64 beyond 2G */
+        if (disk.layout_size > INT_MAX)
+            return -EOVERFLOW;
+        size = (int)disk.layout_size;
+        ret = copy_to_user((int __user *)arg, &size, sizeof(int));
+        if (ret) 
+            return -EFAULT;
+        break;
+    case IOC_REQ_DEVICE_SIZE64:                       /* Device Size, 64-bit */
+        size64 = disk.layout_size;
+        ret = copy_to_user((__u64 __user *)arg, &size64, sizeof(__u64));
+        if (ret) 
+            return -EFAULT;
+        break;
+    case IOC_REQ_DEVICE_CLOCK:                        /* Modeled Device Time */
+        size64 = div_u64(atomic64_read(&disk.clock_ns), NSEC_PER_USEC);
+        ret = copy_to_user((__u64 __user *)arg, &size64, sizeof(__u64));
+        if (ret) 
+            return -EFAULT;
+        break;
+    case IOC_REQ_DEVICE_GEOMETRY:                     /* Device Geometry */
+        geo.disk_size   = disk.layout_size;
+        geo.iounit_size = disk.iounit_size;
+        geo.track_num   = CONFIG_TRACK_NUM;
+        ret = copy_to_user((struct ddriver_geometry __user *)arg, &geo, 
+                           sizeof(struct ddriver_geometry));
         if (ret) 
             return -EFAULT;
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
-        ret = copy_to_user((int __user *)arg, &state, sizeof(struct ddriver_state));
+    case IOC_REQ_DEVICE_STATS:                        /* Detailed Statistics */
+        stats = kmalloc(sizeof(struct ddriver_stats), GFP_KERNEL);
+        if (stats == NULL)
+            return -ENOMEM;
+        collect_stats(stats);
+        if (cmd == IOC_REQ_DEVICE_STATE) {
+            state.read_cnt = stats->reads;
+            state.write_cnt = stats->writes;
+            state.seek_cnt = stats->seeks;
+            ret = copy_to_user((struct ddriver_state __user *)arg, &state, 
+                               sizeof(struct ddriver_state));
+        } else {
+            ret = copy_to_user((struct ddriver_stats __user *)arg, stats, 
+                               sizeof(struct ddriver_stats));
+        }
+        kfree(stats);
         if (ret) 
             return -EFAULT;
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        disk.head = disk.layout;
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        RESET_HEAD((struct ddriver_file *)file->private_data);
+        atomic64_set(&disk.arm, 0);
+        atomic64_set(&disk.clock_ns, 0);
+        mutex_lock(&ctl_lock);
+        reset_stats();
+        mutex_unlock(&ctl_lock);
+        break;
+    case IOC_REQ_DEVICE_STATS_RESET:                  /* Reset Statistics Only */
+        mutex_lock(&ctl_lock);
+        reset_stats();
+        mutex_unlock(&ctl_lock);
+        break;
+    case IOC_REQ_DEVICE_REGIONS:                      /* Register Layout */
+        if (copy_from_user(&regions, (struct ddriver_regions __user *)arg, 
+                           sizeof(struct ddriver_regions)))
+            return -EFAULT;
+        if (regions.nr > DDRIVER_REGION_MAX)
+            return -EINVAL;
+        for (i = 0; i < regions.nr; i++) {
+            if (regions.region[i].start >= regions.region[i].end)
+                return -EINVAL;
+            regions.region[i].name[DDRIVER_REGION_NAME_LEN - 1] = '\0';
+        }
+        mutex_lock(&ctl_lock);
+        WRITE_ONCE(disk.regions.nr, 0);               /* Hide the old layout while replacing it */
+        memcpy(disk.regions.region, regions.region, sizeof(regions.region));
+        for_each_possible_cpu(i)
+            memset(per_cpu_ptr(disk.stats, i)->region, 0, 
+                   sizeof(struct ddriver_region_stats) * DDRIVER_REGION_MAX);
+        WRITE_ONCE(disk.regions.nr, regions.nr);
+        mutex_unlock(&ctl_lock);
+        break;
+    case IOC_REQ_DEVICE_TOPOLOGY:                     /* Device Topology, many blocks per call */
+        memset(&topo, 0, sizeof(struct ddriver_topology));
+        topo.disk_size       = disk.layout_size;
+        topo.min_io_size     = disk.iounit_size;
+        topo.alignment       = disk.iounit_size;
+        topo.max_transfer    = ADDR_ROUND_UP(min_t(loff_t, disk.layout_size, MAX_RW_COUNT));
+        topo.optimal_io_size = optimal_io_size(topo.max_transfer);
+        topo.nr_queues       = 1;
+        topo.queue_depth     = 1;
+        topo.flags           = 0;                     /* No discard, memory needs no flush */
+        if (prof.rot_lat != 0)
+            topo.flags |= DDRIVER_TOPO_ROTATIONAL;
+        ret = copy_to_user((struct ddriver_topology __user *)arg, &topo, 
+                           sizeof(struct ddriver_topology));
+        if (ret) 
+            return -EFAULT;
+        break;
+    case IOC_REQ_DEVICE_BATCH:                        /* Batched Requests */
+        return device_batch(file->private_data, (struct ddriver_batch __user *)arg);
+    case IOC_REQ_DEVICE_REAP:                         /* Completed Async Batches */
+        size64 = atomic64_xchg(&((struct ddriver_file *)file->private_data)->batch_done, 0);
+        ret = copy_to_user((__u64 __user *)arg, &size64, sizeof(__u64));
+        if (ret) 
+            return -EFAULT;
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         ret = copy_to_user((int __user *)arg, &disk.iounit_size, sizeof(int));
@@ -234,22 +1047,26 @@ device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
     return 0;
 }
 /**
- * @brief Disk Open
+ * @brief Disk Open, any number of opens may share the disk
  * 
  * @param inode         Ignored
- * @param file          Ignored
+ * @param file          Gets its own head at offset 0
  * @return int          state
  */
 static int 
 device_open(struct inode *inode, struct file *file) {
+    struct ddriver_file *f;
     IGNORE_ARG(inode);
-    IGNORE_ARG(file);
     
-    if (disk.open_count) {                            /* If device is open, return busy */
-        return -EBUSY;
-    }
-    RESET_HEAD(disk);                                 /* Everytime close device, reset head */
-    disk.open_count++;
+    f = kzalloc(sizeof(struct ddriver_file), GFP_KERNEL);
+    if (f == NULL)
+        return -ENOMEM;
+    atomic64_set(&f->batch_done, 0);
+    INIT_LIST_HEAD(&f->pending);
+    spin_lock_init(&f->pending_lock);
+    init_waitqueue_head(&f->wait);
+    file->private_data = f;
+    atomic_inc(&disk.open_count);
     try_module_get(THIS_MODULE);
     return 0;
 }
@@ -257,16 +1074,32 @@ device_open(struct inode *inode, struct file *file) {
  * @brief Disk Close
  * 
  * @param inode         Ignored
- * @param file          Ignored
+ * @param file          Its async batches complete now, without waiting out 
+ *                      their modeled latency
  * @return int          state
  */
 static int 
 device_release(struct inode *inode, struct file *file) {
                                                       /* Decrement the open counter and usage count. 
                                                          Without this, the module would not unload. */
+    struct ddriver_file *f = file->private_data;
+    struct ddriver_pending *p;
     IGNORE_ARG(inode);
-    IGNORE_ARG(file);
-    disk.open_count--;
+
+    spin_lock_bh(&f->pending_lock);
+    while (!list_empty(&f->pending)) {
+        p = list_first_entry(&f->pending, struct ddriver_pending, node);
+        list_del_init(&p->node);
+        spin_unlock_bh(&f->pending_lock);
+        hrtimer_cancel(&p->timer);                    /* Waits out a callback already running */
+        complete_batch(f, p->efd);
+        kfree(p);
+        spin_lock_bh(&f->pending_lock);
+    }
+    spin_unlock_bh(&f->pending_lock);
+    kfree(f);
+    file->private_data = NULL;
+    atomic_dec(&disk.open_count);
     module_put(THIS_MODULE);
     return 0;
 }
@@ -276,16 +1109,44 @@ device_release(struct inode *inode, struct file *file) {
 static int __init 
 ddriver_init(void)
 {
-    int major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
+    int major_num;
+    loff_t size = memparse(disk_size, NULL);
+
+    if (size < CONFIG_BLOCK_SZ || size % CONFIG_BLOCK_SZ != 0) {
+        kernel_alert("disk_size %s should be a positive multiple of %d", 
+                     disk_size, CONFIG_BLOCK_SZ);
+        return -EINVAL;
+    }
+    if (profile_load(profile) < 0)
+        return -EINVAL;
+    disk.layout = vmalloc_user(size);                 /* Zeroed, and can be mapped to user space */
+    if (disk.layout == NULL) {
+        kernel_alert("Can't allocate a disk of %lld bytes", size);
+        return -ENOMEM;
+    }
+    disk.layout_size = size;
+    disk.stats = alloc_percpu(struct ddriver_stats);
+    if (disk.stats == NULL) {
+        vfree(disk.layout);
+        disk.layout = NULL;
+        return -ENOMEM;
+    }
+
+    major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
                                                       /* Register an device */
     if (major_num < 0) {                              /* Register fail */
         kernel_alert("Can't register device, ret %d", major_num);
+        free_percpu(disk.stats);
+        disk.stats = NULL;
+        vfree(disk.layout);
+        disk.layout = NULL;
         return major_num;
     } 
     else {                                            /* Register success */                                                  
-        kernel_info("module loaded with device major number %d", major_num);
+        /* ddriver.sh takes the last word of this line as the major number */
+        kernel_info("module loaded, disk size %lld, device major number %d", 
+                    disk.layout_size, major_num);
         disk.major_num = major_num;
-        memset(disk.layout, 0, CONFIG_DISK_SZ);
         return 0;
     }
     return 0;
@@ -299,6 +1160,10 @@ ddriver_exit(void)
     if(major_num != 0){
         unregister_chrdev(major_num, DEVICE_NAME);
     }
+    free_percpu(disk.stats);
+    disk.stats = NULL;
+    vfree(disk.layout);
+    disk.layout = NULL;
 }
 
 module_init(ddriver_init);
@@ -2,6 +2,7 @@
 #define _DDRIVER_CTL_H_
 
 #include <linux/ioctl.h>   
+#include <linux/types.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -14,8 +15,121 @@ struct ddriver_state
     int seek_cnt;
 };
 
+struct ddriver_geometry
+{
+    __u64    disk_size;
+    __u32    iounit_size;
+    __u32    track_num;
+};
+
+#define DDRIVER_TOPO_DISCARD    0x1
+#define DDRIVER_TOPO_FLUSH      0x2
+#define DDRIVER_TOPO_WCACHE     0x4
+#define DDRIVER_TOPO_ROTATIONAL 0x8
+
+struct ddriver_topology
+{
+    __u64    disk_size;
+    __u32    min_io_size;
+    __u32    optimal_io_size;
+    __u32    alignment;
+    __u32    max_transfer;
+    __u32    nr_queues;
+    __u32    queue_depth;
+    __u32    flags;
+    __u32    reserved;
+};
+
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_GEOMETRY _IOR(IOC_MAGIC, 4, struct ddriver_geometry)
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 5, __u64)
+#define IOC_REQ_DEVICE_CLOCK    _IOR(IOC_MAGIC, 6, __u64)
+#define IOC_REQ_DEVICE_STATS    _IOR(IOC_MAGIC, 8, struct ddriver_stats)
+#define IOC_REQ_DEVICE_STATS_RESET _IO(IOC_MAGIC, 9)
+#define IOC_REQ_DEVICE_REGIONS  _IOW(IOC_MAGIC, 10, struct ddriver_regions)
+#define IOC_REQ_DEVICE_TOPOLOGY _IOR(IOC_MAGIC, 17, struct ddriver_topology)
+#define IOC_REQ_DEVICE_BATCH    _IOWR(IOC_MAGIC, 18, struct ddriver_batch)
+#define IOC_REQ_DEVICE_REAP     _IOR(IOC_MAGIC, 19, __u64)
+
+/******************************************************************************
+* SECTION: Statistics
+*******************************************************************************/
+#define DDRIVER_STATS_VERSION   1
+#define DDRIVER_LAT_BUCKETS     20
+#define DDRIVER_REGION_MAX      8
+#define DDRIVER_REGION_NAME_LEN 16
+
+struct ddriver_region
+{
+    __u64    start;
+    __u64    end;
+    char     name[DDRIVER_REGION_NAME_LEN];
+};
+
+struct ddriver_regions
+{
+    __u32    nr;
+    struct ddriver_region region[DDRIVER_REGION_MAX];
+};
+
+struct ddriver_region_stats
+{
+    struct ddriver_region region;
+    __u64    reads;
+    __u64    writes;
+    __u64    bytes_read;
+    __u64    bytes_written;
+};
+
+struct ddriver_stats
+{
+    __u32    version;
+    __u32    size;
+    __u64    reads;
+    __u64    writes;
+    __u64    seeks;
+    __u64    bytes_read;
+    __u64    bytes_written;
+    __u64    seq_accesses;
+    __u64    rand_accesses;
+    __u64    seek_distance;
+    __u64    lat_total_us;
+    __u64    lat_max_us;
+    __u64    lat_hist[DDRIVER_LAT_BUCKETS];
+    __u32    nr_regions;
+    __u32    reserved;
+    struct ddriver_region_stats region[DDRIVER_REGION_MAX];
+};
+
+/******************************************************************************
+* SECTION: Batched requests
+*******************************************************************************/
+#define DDRIVER_OP_READ         0
+#define DDRIVER_OP_WRITE        1
+#define DDRIVER_OP_WRITE_FUA    2
+#define DDRIVER_OP_DISCARD      3
+#define DDRIVER_BATCH_MAX       256
+#define DDRIVER_BATCH_ASYNC     0x1
+
+struct ddriver_iodesc
+{
+    __u32    op;
+    __s32    res;
+    __u64    offset;
+    __u64    length;
+    __u64    buf;
+};
+
+struct ddriver_batch
+{
+    __u32    nr;
+    __u32    flags;
+    __s32    eventfd;
+    __u32    reserved;
+    __u64    descs;
+};
+
 #endif
\ No newline at end of file
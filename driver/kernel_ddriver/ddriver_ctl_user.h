@@ -2,6 +2,7 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <stdint.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -13,9 +14,121 @@ struct ddriver_state
     int seek_cnt;
 };
 
+struct ddriver_geometry
+{
+    uint64_t disk_size;
+    uint32_t iounit_size;
+    uint32_t track_num;
+};
+
+#define DDRIVER_TOPO_DISCARD    0x1
+#define DDRIVER_TOPO_FLUSH      0x2
+#define DDRIVER_TOPO_WCACHE     0x4
+#define DDRIVER_TOPO_ROTATIONAL 0x8
+
+struct ddriver_topology
+{
+    uint64_t disk_size;
+    uint32_t min_io_size;
+    uint32_t optimal_io_size;
+    uint32_t alignment;
+    uint32_t max_transfer;
+    uint32_t nr_queues;
+    uint32_t queue_depth;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_GEOMETRY _IOR(IOC_MAGIC, 4, struct ddriver_geometry)
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 5, uint64_t)
+#define IOC_REQ_DEVICE_CLOCK    _IOR(IOC_MAGIC, 6, uint64_t)
+#define IOC_REQ_DEVICE_STATS    _IOR(IOC_MAGIC, 8, struct ddriver_stats)
+#define IOC_REQ_DEVICE_STATS_RESET _IO(IOC_MAGIC, 9)
+#define IOC_REQ_DEVICE_REGIONS  _IOW(IOC_MAGIC, 10, struct ddriver_regions)
+#define IOC_REQ_DEVICE_TOPOLOGY _IOR(IOC_MAGIC, 17, struct ddriver_topology)
+#define IOC_REQ_DEVICE_BATCH    _IOWR(IOC_MAGIC, 18, struct ddriver_batch)
+#define IOC_REQ_DEVICE_REAP     _IOR(IOC_MAGIC, 19, uint64_t)
+
+/******************************************************************************
+* SECTION: Statistics
+*******************************************************************************/
+#define DDRIVER_STATS_VERSION   1
+#define DDRIVER_LAT_BUCKETS     20
+#define DDRIVER_REGION_MAX      8
+#define DDRIVER_REGION_NAME_LEN 16
+
+struct ddriver_region
+{
+    uint64_t start;
+    uint64_t end;
+    char     name[DDRIVER_REGION_NAME_LEN];
+};
+
+struct ddriver_regions
+{
+    uint32_t nr;
+    struct ddriver_region region[DDRIVER_REGION_MAX];
+};
+
+struct ddriver_region_stats
+{
+    struct ddriver_region region;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+};
+
+struct ddriver_stats
+{
+    uint32_t version;
+    uint32_t size;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t seeks;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t seq_accesses;
+    uint64_t rand_accesses;
+    uint64_t seek_distance;
+    uint64_t lat_total_us;
+    uint64_t lat_max_us;
+    uint64_t lat_hist[DDRIVER_LAT_BUCKETS];
+    uint32_t nr_regions;
+    uint32_t reserved;
+    struct ddriver_region_stats region[DDRIVER_REGION_MAX];
+};
+
+/******************************************************************************
+* SECTION: Batched requests
+*******************************************************************************/
+#define DDRIVER_OP_READ         0
+#define DDRIVER_OP_WRITE        1
+#define DDRIVER_OP_WRITE_FUA    2
+#define DDRIVER_OP_DISCARD      3
+#define DDRIVER_BATCH_MAX       256
+#define DDRIVER_BATCH_ASYNC     0x1
+
+struct ddriver_iodesc
+{
+    uint32_t op;
+    int32_t  res;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t buf;
+};
+
+struct ddriver_batch
+{
+    uint32_t nr;
+    uint32_t flags;
+    int32_t  eventfd;
+    uint32_t reserved;
+    uint64_t descs;
+};
 
 #endif
\ No newline at end of file
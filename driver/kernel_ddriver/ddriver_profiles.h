@@ -0,0 +1,28 @@
+#ifndef _DDRIVER_PROFILES_H_
+#define _DDRIVER_PROFILES_H_
+/******************************************************************************
+* SECTION: Builtin device profiles
+*******************************************************************************/
+/**
+ * Builtin device profiles, kept identical to ddriver_profiles.h of the user 
+ * driver so that both backends model the same device. One key = value per ';':
+ *   read_lat / write_lat   p50 [p99 [p999]], overhead of each request (us)
+ *   seek_lat / stroke_lat  Track-to-track / full stroke seek (us)
+ *   rot_lat                One revolution (us), 0 for no moving parts
+ *   bandwidth              Media transfer rate (bytes/s), K/M/G suffix allowed
+ *   slow                   start length factor, accesses inside take factor times longer
+ */
+#define DDRIVER_BUILTIN_PROFILES                                                            \
+    { "default",  "read_lat = 200; write_lat = 100; seek_lat = 500; stroke_lat = 8000;"     \
+                  "rot_lat = 8333; bandwidth = 128000000" },                                \
+    { "hdd",      "read_lat = 200 1500 12000; write_lat = 100 1000 10000; seek_lat = 500;"  \
+                  "stroke_lat = 8000; rot_lat = 8333; bandwidth = 150M" },                  \
+    { "sata-ssd", "read_lat = 90 400 2000; write_lat = 40 1500 8000; seek_lat = 0;"         \
+                  "stroke_lat = 0; rot_lat = 0; bandwidth = 520M" },                        \
+    { "nvme",     "read_lat = 20 80 400; write_lat = 15 60 1500; seek_lat = 0;"             \
+                  "stroke_lat = 0; rot_lat = 0; bandwidth = 3000M" },                       \
+    { "sdcard",   "read_lat = 400 3000 20000; write_lat = 1500 30000 150000; seek_lat = 0;" \
+                  "stroke_lat = 0; rot_lat = 0; bandwidth = 20M" },                         \
+    { NULL, NULL }
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "stdio.h"
 #include "stdlib.h"
 #include <unistd.h>
@@ -5,76 +6,22 @@
 #include <fcntl.h>
 #include "string.h"
 #include <linux/fs.h>
-#include "ddriver_ctl.h"
+#include "ddriver_core.h"
 #include "stdio.h"
 #include "errno.h"
-#include <pwd.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/file.h>
 
 extern int errno;
 
-#define USER_INFO     "INFO: "
-#define USER_ALERT    "WARNING: "
-
-#define USER_PANIC    "PANIC: "
 /******************************************************************************
 * SECTION: Macro definitions
 *******************************************************************************/   
-#define DEVICE_NAME   "ddriver"
-#define DEVICE_LOG    "ddriver_log"
-
-#define user_info(fmt, ...)\
-	do {\
-		printf(USER_INFO DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
-        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-	} while(0)\
-
-#define user_alert(fmt, ...)\
-	do {\
-		printf(USER_ALERT DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
-        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-	} while(0)\
-
-#define user_panic(fmt, ...)\
-    do {\
-        printf(USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
-    } while (0)\
-
 #define DRIVER_AUTHOR   "Deadpool <deadpoolmine@qq.com>"
 #define DRIVER_DESC     "A Fake disk driver in user space"
 #define DRIVER_VERSION  "0.1.0"
 
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
-#define CONFIG_BLOCK_SZ (512)
-/******************************************************************************
-* SECTION: Macro Functions 
-*******************************************************************************/
-#define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
-
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
-
-#define RW_DELAY(disk, rw_ops)  (usleep(disk.rw_ops##_lat * 1000))
-/******************************************************************************
-* SECTION: Type definitions
-*******************************************************************************/
-struct ddriver
-{
-    int  ddriver_fd;                                 /* Disk ddriver_fd */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
-    int  read_lat;
-    int  write_lat;
-    int  seek_lat;
-    int  track_num;
-    int  major_num;
-    int  layout_size;
-    int  iounit_size;
-};
 /******************************************************************************
 * SECTION: Global Variable
 *******************************************************************************/
@@ -83,95 +30,596 @@ struct ddriver disk = {
     .read_cnt    = 0,
     .write_cnt   = 0,
     .seek_cnt    = 0,
-    .read_lat    = 2,       /* 2ms */       
-    .write_lat   = 1,       /* 1ms */
-    .seek_lat    = 4,       /* 4.17ms per 360 degree */
+    .read_lat    = { 200, 200, 200 },   /* 200us controller overhead per read request */
+    .write_lat   = { 100, 100, 100 },   /* 100us controller overhead per write request */
+    .seek_lat    = 500,     /* 0.5ms track-to-track */
+    .stroke_lat  = 8000,    /* 8ms full stroke */
+    .rot_lat     = 8333,    /* 8.33ms per 360 degree, 7200 RPM */
+    .xfer_ns     = 4000,    /* 4us per IO unit, ~128MB/s media rate; see ddriver_profile.c */
+    .ddriver_fd  = -1,
     .major_num   = 0,
     .track_num   = 100,
     .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
+    .iounit_size = CONFIG_BLOCK_SZ,
+    .head        = 0,
+    .clock_us    = 0,
+    .open_cnt    = 0,
+    .flags       = 0,
+    .sched       = DDRIVER_SCHED_NOOP,
+    .map         = NULL,
+    .lock        = PTHREAD_MUTEX_INITIALIZER
 };
 
 FILE *debugf = NULL;
+/* ddriver_seek/read/write的游标按线程保存，多线程各自seek+read互不干扰 */
+static __thread off_t cursor = 0;
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
+/**
+ * @brief 计入一段模拟延迟并推进设备时钟
+ *        DDRIVER_OPEN_NODELAY：零延迟设备，既不休眠也不推进时钟
+ *        DDRIVER_OPEN_SIMCLOCK：只推进时钟，不休眠
+ * 
+ * @param us 微秒
+ */
+void ddriver_delay(long us) {
+    if (us <= 0 || (disk.flags & DDRIVER_OPEN_NODELAY)) {
+        return;
+    }
+    if (ddriver_queue_enabled())
+        ddriver_queue_advance(us);
+    else
+        atomic_fetch_add_explicit(&disk.clock_us, us, memory_order_relaxed);
+    if (disk.flags & DDRIVER_OPEN_SIMCLOCK) {
+        return;
+    }
+    usleep(us);
+}
+
 int check_valid(size_t size) {
-    if (size != CONFIG_BLOCK_SZ){
-        user_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+    if (size != disk.iounit_size){
+        user_alert("io size %ld should align to %d", size, disk.iounit_size);
         return -EIO;
     }
     return 0;
 }
 
+int check_range(off_t offset, size_t size) {
+    if (!IS_ADDR_ALIGN(offset)) {
+        user_alert("offset %ld must be aligned to block size %d", 
+                      offset, disk.iounit_size);
+        return -EINVAL;
+    }
+    if (offset < 0 || offset + (off_t)size > disk.layout_size) {
+        user_alert("access [%ld, %ld) out of disk range", 
+                      offset, offset + (off_t)size);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int check_iov(const struct iovec *iov, int iovcnt, size_t *total) {
+    if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+        user_alert("iov count %d out of range", iovcnt);
+        return -EINVAL;
+    }
+    *total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0 || iov[i].iov_len % disk.iounit_size != 0) {
+            user_alert("iov[%d] size %ld should align to %d", 
+                          i, iov[i].iov_len, disk.iounit_size);
+            return -EIO;
+        }
+        *total += iov[i].iov_len;
+    }
+    if (*total > CONFIG_MAX_TRANSFER) {
+        user_alert("request of %ld bytes exceeds max transfer %d", *total, CONFIG_MAX_TRANSFER);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * 磁头模型：磁盘均分为track_num个磁道，偏移所在磁道为 offset / 每道字节数，
+ * 道内位置对应盘片角度。从from移到to的代价为
+ *   寻道：跨越磁道时 seek_lat + (stroke_lat - seek_lat) * 跨越道数 / (track_num - 1)
+ *   旋转：寻道期间盘片继续转动，之后等待目标扇区转到磁头下
+ * 盘片角度只随磁头移动与寻道推进，不随空闲时间推进，因此结果可复现，
+ * 且紧接上次请求末尾的顺序访问没有任何定位代价。
+ * size为盘片容量，阵列的每个成员是一个容量为成员大小的独立盘片
+ */
+long emulate_spindle_lat(off_t size, off_t from, off_t to) {
+    off_t bytes_per_track = size / disk.track_num;
+    off_t from_track = from / bytes_per_track;
+    off_t to_track   = to / bytes_per_track;
+    off_t distance   = to_track > from_track ? to_track - from_track
+                                             : from_track - to_track;
+    long  seek = 0, angle, target;
+
+    if (from == to || disk.rot_lat == 0) {
+        return 0;                                    /* 没有机械部件的设备不付定位代价 */
+    }
+    if (distance != 0) {
+        seek = disk.seek_lat;
+        if (disk.track_num > 1) {
+            seek += (disk.stroke_lat - disk.seek_lat) * distance 
+                    / (disk.track_num - 1);
+        }
+    }
+    angle  = (from % bytes_per_track) * disk.rot_lat / bytes_per_track;
+    angle  = (angle + seek) % disk.rot_lat;
+    target = (to % bytes_per_track) * disk.rot_lat / bytes_per_track;
+    return seek + (target - angle + disk.rot_lat) % disk.rot_lat;
+}
+
+long emulate_position_lat(off_t from, off_t to) {
+    return emulate_spindle_lat(disk.layout_size, from, to);
+}
+
+/**
+ * 从磁头当前位置访问[offset, offset + total)的定位与传输延迟，并移动磁头；
+ * 组成阵列时磁头仍按逻辑地址移动用于统计，延迟由各成员的磁头决定；
+ * 多队列模型模拟没有机械定位的设备，延迟为所在队列的排队 + 服务时间。
+ * 访问设备档案中的慢区间时，服务时间按区间的倍数放大。
+ * mirror为镜像读实际读数据的成员，见ddriver_array_mirror_member
+ */
+long emulate_access_lat(int is_write, off_t offset, size_t total, int mirror) {
+    off_t from = atomic_exchange(&disk.head, offset + total);
+    long  lat;
+
+    if (offset != from)
+        INC_SEEKCNT(disk);
+    ddriver_stats_seek(from, offset);
+    if (ddriver_queue_enabled()) {
+        lat = is_write ? RW_LAT(disk, write, total / disk.iounit_size)
+                       : RW_LAT(disk, read, total / disk.iounit_size);
+        return ddriver_queue_service(total, ddriver_profile_slow(offset, total, lat));
+    }
+    if (ddriver_array_active())
+        lat = ddriver_array_lat(is_write, offset, total, mirror);
+    else if (is_write)
+        lat = emulate_position_lat(from, offset) + RW_LAT(disk, write, total / disk.iounit_size);
+    else
+        lat = emulate_position_lat(from, offset) + RW_LAT(disk, read, total / disk.iounit_size);
+    return ddriver_profile_slow(offset, total, lat);
+}
+
 int emulate_rotate(int fd, off_t start, off_t end) {
-    int bytes_per_track = disk.layout_size / disk.track_num;
-    int lat_per_track = disk.seek_lat;
-    int distance = abs(end - start) % bytes_per_track; 
-    
-    if (distance == 0) {
-        return 0;
+    IGNORE_ARG(fd);
+    ddriver_delay(emulate_position_lat(start, end));
+    return 0;
+}
+
+/* 按阵列、写时复制层、映射或后端文件下发，不再判断O_DIRECT中转，供中转路径使用 */
+ssize_t store_backend_readv(const struct iovec *iov, int iovcnt, off_t offset, int mirror) {
+    ssize_t done = 0;
+    if (ddriver_array_active()) {
+        return ddriver_array_readv(iov, iovcnt, offset, mirror);
+    }
+    if (ddriver_overlay_active()) {
+        return ddriver_overlay_readv(iov, iovcnt, offset);
+    }
+    if (disk.map == NULL) {
+        return preadv(disk.ddriver_fd, iov, iovcnt, offset);
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].iov_base, disk.map + offset + done, iov[i].iov_len);
+        done += iov[i].iov_len;
+    }
+    return done;
+}
+
+ssize_t store_backend_writev(const struct iovec *iov, int iovcnt, off_t offset) {
+    ssize_t done = 0;
+    if (ddriver_array_active()) {
+        return ddriver_array_writev(iov, iovcnt, offset);
+    }
+    if (ddriver_overlay_active()) {
+        return ddriver_overlay_writev(iov, iovcnt, offset);
+    }
+    if (disk.map == NULL) {
+        return pwritev(disk.ddriver_fd, iov, iovcnt, offset);
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(disk.map + offset + done, iov[i].iov_base, iov[i].iov_len);
+        done += iov[i].iov_len;
+    }
+    return done;
+}
+
+ssize_t store_readv(int fd, const struct iovec *iov, int iovcnt, off_t offset, int mirror) {
+    IGNORE_ARG(fd);
+    if (ddriver_direct_needs_bounce(iov, iovcnt)) {
+        return ddriver_direct_readv(iov, iovcnt, offset, mirror);
+    }
+    return store_backend_readv(iov, iovcnt, offset, mirror);
+}
+
+ssize_t store_writev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    IGNORE_ARG(fd);
+    if (ddriver_direct_needs_bounce(iov, iovcnt)) {
+        return ddriver_direct_writev(iov, iovcnt, offset);
     }
+    return store_backend_writev(iov, iovcnt, offset);
+}
+/**
+ * 将后端文件fd的[offset, offset + size)清零：默认打洞释放后端空间，预分配模式下
+ * 就地清零保留空间，后端文件系统不支持时退回逐块写零
+ */
+int store_zero_fd(int fd, off_t offset, off_t size) {
+    static const char zero[4096] __attribute__((aligned(4096)));  /* 兼容O_DIRECT */
+    int mode = (disk.flags & DDRIVER_OPEN_PREALLOC) ? FALLOC_FL_ZERO_RANGE 
+                                                   : FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
 
-    usleep(distance * lat_per_track / bytes_per_track * 1000);
+    if (fallocate(fd, mode, offset, size) == 0) {
+        return 0;
+    }
+    if (errno != EOPNOTSUPP && errno != ENOSYS) {
+        return -errno;
+    }
+    for (off_t done = 0; done < size; done += sizeof(zero)) {
+        size_t n = size - done < (off_t)sizeof(zero) ? size - done : sizeof(zero);
+        if (pwrite(fd, zero, n, offset + done) != (ssize_t)n) {
+            return -EIO;
+        }
+    }
     return 0;
 }
+
+int store_zero(off_t offset, off_t size) {
+    if (ddriver_array_active()) {
+        return ddriver_array_zero(offset, size);
+    }
+    ddriver_overlay_mark(offset, size);               /* 之后读设备文件，而不是快照 */
+    return store_zero_fd(disk.ddriver_fd, offset, size);
+}
+
+/**
+ * 清空整个磁盘：非mmap、非预分配时截断再扩展，与设备大小无关；
+ * 否则整体打洞，避免mmap映射在截断期间失效
+ */
+int store_reset(void) {
+    ddriver_overlay_drop();
+    if (ddriver_array_active()) {
+        return ddriver_array_reset();
+    }
+    if (disk.map == NULL && !(disk.flags & DDRIVER_OPEN_PREALLOC)) {
+        if (ftruncate(disk.ddriver_fd, 0) < 0 || 
+            ftruncate(disk.ddriver_fd, disk.layout_size) < 0) {
+            return -errno;
+        }
+        return 0;
+    }
+    return store_zero(0, disk.layout_size);
+}
+
+/* trace配置为目录时，各设备的轨迹写入其中的<设备文件名>.trace，多个实例互不覆盖 */
+static const char *device_trace_path(const char *trace, const char *device, char *buf, size_t size) {
+    struct stat st;
+    const char *name = strrchr(device, '/');
+
+    if (stat(trace, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return trace;
+    }
+    snprintf(buf, size, "%s/%s.trace", trace, name != NULL ? name + 1 : device);
+    return buf;
+}
 /******************************************************************************
 * SECTION: Global Function Implementation
 *******************************************************************************/
+static int ddriver_open_device(char *path, const struct ddriver_config *cfg);
 /**
- * @brief 打开驱动
+ * @brief 按给定配置打开驱动。设备只在第一次打开时初始化，之后的打开共享
+ *        同一设备，各自得到独立的文件描述符，最后一次关闭时释放设备
  * 
+ * @param path 
+ * @param cfg 
  * @return int 文件描述符
  */
-int ddriver_open(char *path) {
-    int fd, ret = 0;
-    char device_path[128] = {0};
-    char log_path[128] = {0};
-    
-    sprintf(device_path, "%s/" DEVICE_NAME, getpwuid(getuid())->pw_dir);
-    sprintf(log_path, "%s/" DEVICE_LOG, getpwuid(getuid())->pw_dir);
+static int ddriver_open_config(char *path, const struct ddriver_config *cfg) {
+    int fd;
+
+    pthread_mutex_lock(&disk.lock);
+    if (disk.open_cnt > 0) {
+        /* 设备状态是进程内全局的，再次打开只能是同一个设备 */
+        char real[PATH_MAX];
+        if (realpath(path, real) == NULL || strcmp(real, disk.path) != 0) {
+            user_panic("[%s] is open, a process can open one device at a time", disk.path);
+            pthread_mutex_unlock(&disk.lock);
+            errno = EBUSY;
+            return -1;
+        }
+        fd = dup(disk.ddriver_fd);
+        if (fd >= 0) {
+            disk.open_cnt++;
+        }
+        pthread_mutex_unlock(&disk.lock);
+        return fd;
+    }
+    fd = ddriver_open_device(path, cfg);
+    if (fd >= 0) {
+        disk.ddriver_fd = fd;
+        disk.open_cnt   = 1;
+        fd = dup(disk.ddriver_fd);
+    }
+    pthread_mutex_unlock(&disk.lock);
+    return fd;
+}
+/**
+ * @brief 初始化设备，调用者持有disk.lock
+ * 
+ * @param path 
+ * @param cfg 
+ * @return int 设备自身持有的文件描述符
+ */
+static int ddriver_open_device(char *path, const struct ddriver_config *cfg) {
+    int fd, ret = 0, nr_fds, fds[DDRIVER_ARRAY_MAX];
+    struct stat st;
+    char log_path[PATH_MAX + sizeof(DEVICE_LOG_SUFFIX)];
+    char trace_path[PATH_MAX * 2];
     
-    if (strcmp(device_path, path) != 0) {
-        user_panic("wrong path [%s], should be [%s]", path, device_path);
+    if (ddriver_config_check(cfg) < 0) {
         return -1;
     }
 
-    if (access(device_path, F_OK) == 0) {
-        fd = open(device_path, O_RDWR);
+    if (access(path, F_OK) == 0) {
+        fd = open(path, O_RDWR);
     }
     else {
-        fd = open(device_path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+        fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
     }
     if (fd < 0) {
-        user_panic("can't open device: %d", fd);
+        user_panic("can't open device [%s]: %s", path, strerror(errno));
         return fd;
     }
-    ret = posix_fallocate(fd, 0, CONFIG_DISK_SZ);
-    if (ret < 0) {
+    /* 一个镜像同一时刻只属于一个进程，不同镜像上的实例互不影响，可以并行运行 */
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        user_panic("device [%s] is in use by another process", path);
+        close(fd);
+        errno = EBUSY;
+        return -1;
+    }
+    if (realpath(path, disk.path) == NULL) {
+        snprintf(disk.path, sizeof(disk.path), "%s", path);
+    }
+    /* 默认为稀疏文件，只有写入过的块占用空间；组成阵列时数据在成员文件中 */
+    if (cfg->raid != DDRIVER_RAID_NONE) {
+        ret = 0;
+    }
+    else if (cfg->flags & DDRIVER_OPEN_PREALLOC) {
+        ret = posix_fallocate(fd, 0, cfg->disk_size);
+    }
+    else if (fstat(fd, &st) == 0 && st.st_size < (off_t)cfg->disk_size) {
+        ret = ftruncate(fd, cfg->disk_size) < 0 ? errno : 0;
+    }
+    if (ret != 0) {
         user_panic("low space");
-        return ret;
+        close(fd);
+        return -ret;
     }
 
+    /* 以下任一步失败时，按初始化的逆序回退已完成的步骤 */
+    snprintf(log_path, sizeof(log_path), "%s" DEVICE_LOG_SUFFIX, path);
     debugf = fopen(log_path, "w+");
     if (debugf == NULL) {
         user_panic("can't init log: %s", log_path);
-        return -1;
+        goto err_close;
+    }
+
+    disk.layout_size = cfg->disk_size;
+    disk.iounit_size = cfg->iounit_size;
+    disk.track_num   = cfg->track_num;
+    if (ddriver_profile_load(cfg->profile, cfg->profile_set[0] ? cfg->profile_set : NULL,
+                             cfg->seed) < 0) {
+        goto err_log;
+    }
+    atomic_store(&disk.head, 0);
+    atomic_store(&disk.stats.last_end, 0);
+    atomic_store(&disk.batch_done, 0);
+    disk.regions.nr  = 0;
+    ddriver_stats_reset();
+    disk.flags       = cfg->flags;
+    disk.sched       = cfg->sched;
+    disk.map         = NULL;
+    if (disk.flags & DDRIVER_OPEN_MMAP) {
+        disk.map = mmap(NULL, disk.layout_size, PROT_READ | PROT_WRITE, 
+                        MAP_SHARED, fd, 0);
+        if (disk.map == MAP_FAILED) {
+            user_panic("can't mmap device: %s", strerror(errno));
+            disk.map = NULL;
+            goto err_log;
+        }
+    }
+    if (cfg->raid != DDRIVER_RAID_NONE && ddriver_array_open(cfg) < 0) {
+        goto err_map;
+    }
+    if (ddriver_overlay_load(path) < 0) {
+        goto err_array;
     }
+    nr_fds = ddriver_array_fds(fds);
+    if (nr_fds == 0) {
+        fds[nr_fds++] = fd;
+    }
+    if ((disk.flags & DDRIVER_OPEN_DIRECT) && ddriver_direct_init(fds, nr_fds) < 0) {
+        user_alert("falling back to buffered I/O");
+        disk.flags &= ~DDRIVER_OPEN_DIRECT;
+    }
+    if (cfg->wcache_size != 0 && disk.map != NULL) {
+        user_alert("write cache ignored in mmap mode");
+    }
+    else if (ddriver_cache_init(cfg->wcache_size) < 0) {
+        user_panic("can't allocate write cache of %lu bytes", 
+                   (unsigned long)cfg->wcache_size);
+        goto err_direct;
+    }
+    if (cfg->trace[0] != '\0' &&
+        ddriver_trace_start(device_trace_path(cfg->trace, path, trace_path, sizeof(trace_path))) < 0) {
+        goto err_cache;
+    }
+    if (cfg->nr_queues != 0 && ddriver_queue_init(cfg->nr_queues, cfg->queue_depth) < 0) {
+        user_panic("can't allocate %d hardware queues", cfg->nr_queues);
+        goto err_trace;
+    }
+    if (ddriver_queue_enabled()) {
+        user_info("%d hardware queues of depth %d", cfg->nr_queues, cfg->queue_depth);
+    }
+    user_info("opened, disk size %ld, io size %d, %d tracks%s%s", 
+              disk.layout_size, disk.iounit_size, disk.track_num,
+              (disk.flags & DDRIVER_OPEN_NODELAY)  ? ", no delay" :
+              (disk.flags & DDRIVER_OPEN_SIMCLOCK) ? ", simulated clock" : "",
+              (disk.flags & DDRIVER_OPEN_DIRECT)   ? ", direct I/O" : "");
 
     return fd;
+
+err_trace:
+    ddriver_trace_stop();
+err_cache:
+    ddriver_cache_destroy();
+err_direct:
+    ddriver_direct_destroy();
+    ddriver_overlay_close();
+err_array:
+    ddriver_array_close();
+err_map:
+    if (disk.map != NULL) {
+        munmap(disk.map, disk.layout_size);
+        disk.map = NULL;
+    }
+err_log:
+    fclose(debugf);
+    debugf = NULL;
+err_close:
+    close(fd);
+    return -1;
 }
 /**
- * @brief 关闭驱动
+ * @brief 按指定方式与几何参数打开驱动
+ * 
+ * @param path 
+ * @param flags DDRIVER_OPEN_*
+ * @param geo 为NULL或其中字段为0时，使用配置文件/环境变量/默认值
+ * @return int 文件描述符
+ */
+int ddriver_open_geometry(char *path, int flags, const struct ddriver_geometry *geo) {
+    struct ddriver_config cfg;
+
+    ddriver_config_load(&cfg);
+    cfg.flags |= flags;
+    if (geo != NULL) {
+        if (geo->disk_size)
+            cfg.disk_size = geo->disk_size;
+        if (geo->iounit_size)
+            cfg.iounit_size = geo->iounit_size;
+        if (geo->track_num)
+            cfg.track_num = geo->track_num;
+    }
+    return ddriver_open_config(path, &cfg);
+}
+/**
+ * @brief 按指定方式打开驱动
+ * 
+ * @param path 
+ * @param flags DDRIVER_OPEN_*
+ * @return int 文件描述符
+ */
+int ddriver_open_flags(char *path, int flags) {
+    return ddriver_open_geometry(path, flags, NULL);
+}
+/**
+ * @brief 打开驱动，打开方式与几何参数由配置文件或环境变量决定
+ * 
+ * @return int 文件描述符
+ */
+int ddriver_open(char *path) {
+    return ddriver_open_geometry(path, 0, NULL);
+}
+/**
+ * @brief 关闭驱动，最后一个文件描述符关闭时等待异步请求完成并释放设备
  * 
  * @param fd 
  * @return int 
  */
 int ddriver_close(int fd) {
-    return close(fd) && fclose(debugf);
+    int ret;
+
+    pthread_mutex_lock(&disk.lock);
+    ret = close(fd);
+    if (ret < 0 || --disk.open_cnt > 0) {
+        pthread_mutex_unlock(&disk.lock);
+        return ret;
+    }
+    ddriver_async_stop(disk.ddriver_fd);
+    ddriver_trace_stop();
+    ddriver_cache_flush();
+    ddriver_cache_destroy();
+    ddriver_overlay_sync();
+    ddriver_overlay_close();
+    ddriver_direct_destroy();
+    ddriver_array_close();
+    ddriver_queue_destroy();
+    if (disk.map != NULL) {
+        msync(disk.map, disk.layout_size, MS_SYNC);
+        munmap(disk.map, disk.layout_size);
+        disk.map = NULL;
+    }
+    ret = close(disk.ddriver_fd);
+    if (fclose(debugf) != 0) {
+        ret = -1;
+    }
+    debugf = NULL;
+    disk.ddriver_fd = -1;
+    pthread_mutex_unlock(&disk.lock);
+    return ret;
 }
 /**
- * @brief 磁盘头SEEK
+ * @brief 获取磁盘区间的直接访问指针，仅mmap模式可用
+ * 
+ * 通过该指针的访问不经过延迟模型，也不计入统计；修改在ddriver_flush
+ * 或ddriver_close后落盘
+ * 
+ * @param fd 
+ * @param offset 区间起始偏移
+ * @param size 区间大小
+ * @return void* 区间首地址，非mmap模式或越界时返回NULL
+ */
+void *ddriver_map(int fd, off_t offset, size_t size) {
+    IGNORE_ARG(fd);
+    if (disk.map == NULL) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    if (offset < 0 || offset + (off_t)size > disk.layout_size) {
+        user_alert("map [%ld, %ld) out of disk range", 
+                      offset, offset + (off_t)size);
+        errno = EINVAL;
+        return NULL;
+    }
+    return disk.map + offset;
+}
+/**
+ * @brief 将已完成的写持久化到后端文件：先写回写缓存中的脏块，
+ *        再同步后端文件，与IOC_REQ_DEVICE_FLUSH等价
+ * 
+ * @param fd 
+ * @return int 0成功，否则失败
+ */
+int ddriver_flush(int fd) {
+    IGNORE_ARG(fd);
+    ddriver_trace_drain();
+    if (ddriver_cache_flush() < 0 || ddriver_overlay_sync() < 0) {
+        return -EIO;
+    }
+    if (disk.map != NULL) {
+        return msync(disk.map, disk.layout_size, MS_SYNC);
+    }
+    if (ddriver_array_active()) {
+        return ddriver_array_sync();
+    }
+    return fsync(disk.ddriver_fd);
+}
+/**
+ * @brief 磁盘头SEEK，移动本线程的游标，并将磁头移至该处
  * 
  * @param fd 
  * @param offset 
@@ -179,23 +627,39 @@ int ddriver_close(int fd) {
  * @return int 
  */
 int ddriver_seek(int fd, off_t offset, int whence){
-    int ret = 0;
-    int cur = 0;
+    off_t ret = 0, from;
+    IGNORE_ARG(fd);
 
     if (!IS_ADDR_ALIGN(offset)) {
         user_alert("offset %ld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk.iounit_size);
         return -EINVAL;
     }
 
-    INC_SEEKCNT(disk);
-    cur = lseek(fd, 0, SEEK_CUR);
-    ret = lseek(fd, offset, whence);
+    switch (whence)
+    {
+    case SEEK_SET:
+        ret = offset;
+        break;
+    case SEEK_CUR:
+        ret = cursor + offset;
+        break;
+    case SEEK_END:
+        ret = disk.layout_size + offset;
+        break;
+    default:
+        return -EINVAL;
+    }
     if (ret < 0) {
-        user_panic("seek error: %s", strerror(errno));
-        return ret;
+        user_panic("seek error: offset %ld", ret);
+        return -EINVAL;
     }
-    emulate_rotate(fd, cur, ret);
+
+    INC_SEEKCNT(disk);
+    from = atomic_exchange(&disk.head, ret);
+    ddriver_stats_seek(from, ret);
+    emulate_rotate(fd, from, ret);
+    cursor = ret;
     return ret;
 }
 /**
@@ -210,12 +674,13 @@ int ddriver_write(int fd, char *buf, size_t size){
     int res = check_valid(size);
     if(res < 0)
         return res;
-        
-    RW_DELAY(disk, write);
-    write(fd, buf, size);
 
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    res = ddriver_do_rw(fd, DDRIVER_OP_WRITE, &iov, 1, cursor);
+    if (res < 0)
+        return res;
+    cursor += size;
+    return disk.iounit_size;
 }
 /**
  * @brief 
@@ -230,11 +695,260 @@ int ddriver_read(int fd, char *buf, size_t size){
     if(res < 0)
         return res;
 
-    RW_DELAY(disk, read);
-    read(fd, buf, size);
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    res = ddriver_do_rw(fd, DDRIVER_OP_READ, &iov, 1, cursor);
+    if (res < 0)
+        return res;
+    cursor += size;
+    return disk.iounit_size;
+}
+/**
+ * @brief 执行一次请求：延迟为磁头模型的定位延迟 + 请求开销 + 按IO单位数计的传输延迟，
+ *        计入统计后一次性休眠，可被多线程并发调用
+ * 
+ * 启用写缓存时，普通写只付请求开销与传输延迟，数据留在缓存中，磁头不动，
+ * 定位代价在写回时按排序合并后的访问计入；完全命中缓存的读同样不移动磁头。
+ * 数据传输成功后才计数、移动磁头、记录与休眠，失败的请求不占设备时间
+ * 
+ * @param fd 
+ * @param op DDRIVER_OP_*
+ * @param iov 
+ * @param iovcnt 
+ * @param offset 
+ * @return int 传输的字节数，失败返回负的错误号
+ */
+int ddriver_do_rw(int fd, int op, const struct iovec *iov, 
+                  int iovcnt, off_t offset) {
+    size_t  total;
+    ssize_t done;
+    long    lat;
+    int     is_write = op != DDRIVER_OP_READ, cached = 0;
+    int     use_cache = ddriver_cache_enabled();
+    int     mirror;
+    int res = check_iov(iov, iovcnt, &total);
+    if(res < 0)
+        return res;
+    res = check_range(offset, total);
+    if(res < 0)
+        return res;
+
+    /* 镜像读只选一次成员，数据读取与延迟模型都用它 */
+    mirror = ddriver_array_mirror_member(is_write, offset);
 
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    /* 先完成数据传输，经写缓存时得知是否命中后再计延迟 */
+    if (use_cache) {
+        if (op == DDRIVER_OP_WRITE && ddriver_cache_absorbs(total)) {
+            res    = ddriver_cache_write(iov, iovcnt, offset);
+            cached = 1;
+        }
+        else if (is_write) {
+            res    = ddriver_cache_write_through(iov, iovcnt, offset);
+        }
+        else {
+            res    = ddriver_cache_read(iov, iovcnt, offset, total, mirror);
+            cached = res > 0;
+        }
+        if (res < 0) {
+            user_panic("%s error: %s", is_write ? "write" : "read", strerror(errno));
+            return -EIO;
+        }
+    }
+    else {
+        done = is_write ? store_writev(fd, iov, iovcnt, offset)
+                        : store_readv(fd, iov, iovcnt, offset, mirror);
+        if (done != (ssize_t)total) {
+            user_panic("%s error: %s", is_write ? "write" : "read", strerror(errno));
+            return -EIO;
+        }
+    }
+
+    if (is_write)
+        INC_WRITECNT(disk);
+    else
+        INC_READCNT(disk);
+    if (cached) {
+        lat = is_write ? RW_LAT(disk, write, total / disk.iounit_size)
+                       : RW_LAT(disk, read, total / disk.iounit_size);
+    }
+    else {
+        lat = emulate_access_lat(is_write, offset, total, mirror);
+    }
+    ddriver_stats_account(is_write, offset, total, lat);
+    ddriver_trace_record(op, offset, total, lat);
+    ddriver_delay(lat);
+    return total;
+}
+/**
+ * @brief 丢弃区间：作废写缓存中的脏块并释放后端空间，之后读出为0。
+ *        只付请求开销，不移动磁头，可被多线程并发调用
+ * 
+ * @param fd 
+ * @param offset 对齐到设备IO单位的磁盘偏移
+ * @param size 设备IO单位的整数倍
+ * @return int 0成功，失败返回负的错误号
+ */
+int ddriver_do_discard(int fd, off_t offset, off_t size) {
+    long lat;
+    int  res;
+    IGNORE_ARG(fd);
+
+    if (size <= 0 || size % disk.iounit_size != 0) {
+        user_alert("discard size %ld should align to %d", size, disk.iounit_size);
+        return -EINVAL;
+    }
+    res = check_range(offset, size);
+    if (res < 0)
+        return res;
+
+    ddriver_cache_discard(offset, size);
+    lat = ddriver_profile_write_lat();
+    ddriver_trace_record(DDRIVER_OP_DISCARD, offset, size, lat);
+    ddriver_delay(lat);
+    res = store_zero(offset, size);
+    if (res < 0) {
+        user_panic("discard error: %s", strerror(-res));
+    }
+    return res;
+}
+/**
+ * @brief 定位读，size可为IO单位的整数倍，一次请求完成
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 设备IO单位的整数倍
+ * @param offset 对齐到设备IO单位的磁盘偏移
+ * @return int 读出的字节数，失败返回负的错误号
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    return ddriver_do_rw(fd, DDRIVER_OP_READ, &iov, 1, offset);
+}
+/**
+ * @brief 定位写，size可为IO单位的整数倍，一次请求完成
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 设备IO单位的整数倍
+ * @param offset 对齐到设备IO单位的磁盘偏移
+ * @return int 写入的字节数，失败返回负的错误号
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    return ddriver_do_rw(fd, DDRIVER_OP_WRITE, &iov, 1, offset);
+}
+/**
+ * @brief 分散读：从offset起的连续磁盘区间依次读入iov各段
+ * 
+ * @param fd 
+ * @param iov 每段长度为设备IO单位的整数倍
+ * @param iovcnt 
+ * @param offset 对齐到设备IO单位的磁盘偏移
+ * @return int 读出的字节数，失败返回负的错误号
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    return ddriver_do_rw(fd, DDRIVER_OP_READ, iov, iovcnt, offset);
+}
+/**
+ * @brief 聚集写：将iov各段依次写入从offset起的连续磁盘区间
+ * 
+ * @param fd 
+ * @param iov 每段长度为设备IO单位的整数倍
+ * @param iovcnt 
+ * @param offset 对齐到设备IO单位的磁盘偏移
+ * @return int 写入的字节数，失败返回负的错误号
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    return ddriver_do_rw(fd, DDRIVER_OP_WRITE, iov, iovcnt, offset);
+}
+/**
+ * @brief 带标志的聚集写
+ * 
+ * @param fd 
+ * @param iov 每段长度为设备IO单位的整数倍
+ * @param iovcnt 
+ * @param offset 对齐到设备IO单位的磁盘偏移
+ * @param flags DDRIVER_WRITE_FUA：绕过写缓存，返回时数据已写入后端
+ * @return int 写入的字节数，失败返回负的错误号
+ */
+int ddriver_writev_flags(int fd, const struct iovec *iov, int iovcnt, off_t offset, 
+                         int flags){
+    return ddriver_do_rw(fd, (flags & DDRIVER_WRITE_FUA) ? DDRIVER_OP_WRITE_FUA 
+                                                         : DDRIVER_OP_WRITE, 
+                         iov, iovcnt, offset);
+}
+/**
+ * @brief 批量执行请求描述符，一次调用完成多次访问，各描述符的结果填回res。
+ *        本库中异步批次同样在返回前执行完毕，随后计入REAP计数并通知eventfd，
+ *        与内核设备的接口保持一致
+ * 
+ * @param fd 
+ * @param batch 
+ * @return int 成功的描述符数，参数错误返回负的错误号
+ */
+static int ddriver_do_batch(int fd, const struct ddriver_batch *batch) {
+    struct ddriver_iodesc *desc = (struct ddriver_iodesc *)(uintptr_t)batch->descs;
+    uint64_t one = 1;
+    uint32_t i;
+    int ok = 0;
+
+    if (batch->nr > DDRIVER_BATCH_MAX || (batch->flags & ~DDRIVER_BATCH_ASYNC))
+        return -EINVAL;
+    if (desc == NULL && batch->nr != 0)                /* 与内核设备的memdup_user一致 */
+        return -EFAULT;
+    for (i = 0; i < batch->nr; i++) {
+        struct iovec iov = { .iov_base = (void *)(uintptr_t)desc[i].buf, 
+                             .iov_len  = desc[i].length };
+        switch (desc[i].op)
+        {
+        case DDRIVER_OP_READ:
+        case DDRIVER_OP_WRITE:
+        case DDRIVER_OP_WRITE_FUA:
+            desc[i].res = ddriver_do_rw(fd, desc[i].op, &iov, 1, desc[i].offset);
+            break;
+        case DDRIVER_OP_DISCARD:
+            desc[i].res = ddriver_do_discard(fd, desc[i].offset, desc[i].length);
+            break;
+        default:
+            desc[i].res = -EINVAL;
+            break;
+        }
+        if (desc[i].res >= 0)
+            ok++;
+    }
+    if (batch->flags & DDRIVER_BATCH_ASYNC) {
+        atomic_fetch_add(&disk.batch_done, 1);
+        if (batch->eventfd >= 0 && write(batch->eventfd, &one, sizeof(one)) != sizeof(one))
+            user_alert("can't signal eventfd %d: %s", batch->eventfd, strerror(errno));
+    }
+    return ok;
+}
+/**
+ * 最优请求大小取传输时间与读请求开销 (p50) 相当的大小，此时已能得到
+ * 一半的介质带宽，向上取到2的幂；阵列与多队列模型再各自修正
+ */
+static void ddriver_topology(struct ddriver_topology *topo) {
+    uint64_t units = disk.xfer_ns ? (uint64_t)disk.read_lat.p50 * 1000 / disk.xfer_ns : 1;
+    uint32_t opt   = disk.iounit_size;
+
+    memset(topo, 0, sizeof(struct ddriver_topology));
+    topo->disk_size    = disk.layout_size;
+    topo->min_io_size  = disk.iounit_size;
+    topo->alignment    = disk.iounit_size;
+    topo->max_transfer = disk.layout_size < CONFIG_MAX_TRANSFER ? disk.layout_size
+                                                                : CONFIG_MAX_TRANSFER;
+    while (opt < units * disk.iounit_size && opt < topo->max_transfer) {
+        opt <<= 1;
+    }
+    topo->optimal_io_size = opt;
+    topo->nr_queues       = 1;                       /* 单磁头，同一时刻只服务一个请求 */
+    topo->queue_depth     = 1;
+    topo->flags           = DDRIVER_TOPO_DISCARD | DDRIVER_TOPO_FLUSH;
+    if (ddriver_cache_enabled())
+        topo->flags |= DDRIVER_TOPO_WCACHE;
+    if (disk.rot_lat != 0)
+        topo->flags |= DDRIVER_TOPO_ROTATIONAL;
+    ddriver_array_topology(topo);
+    ddriver_queue_topology(topo);
 }
 /**
  * @brief 
@@ -246,28 +960,105 @@ int ddriver_read(int fd, char *buf, size_t size){
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
     struct ddriver_state state;
+    struct ddriver_geometry geo;
+    struct ddriver_sched_state sched;
+    struct ddriver_stats stats;
+    struct ddriver_regions regions;
+    struct ddriver_cache_state cache;
+    struct ddriver_range range;
+    struct ddriver_snapshot snap;
+    struct ddriver_queues queues;
+    struct ddriver_topology topo;
+    struct ddriver_batch batch;
+    uint64_t size64, clock_us;
+    int size;
     switch (cmd)
     {
-    case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        memcpy(arg, &disk.layout_size, sizeof(int));
+    case IOC_REQ_DEVICE_SIZE:                         /* Device Size, use SIZE64 beyond 2G */
+        if (disk.layout_size > INT_MAX) {             /* Same as the kernel device */
+            user_alert("disk size %ld overflows int, use IOC_REQ_DEVICE_SIZE64", 
+                       disk.layout_size);
+            return -EOVERFLOW;
+        }
+        size = (int)disk.layout_size;
+        memcpy(arg, &size, sizeof(int));
+        break;
+    case IOC_REQ_DEVICE_SIZE64:                       /* Device Size, 64-bit */
+        size64 = disk.layout_size;
+        memcpy(arg, &size64, sizeof(uint64_t));
+        break;
+    case IOC_REQ_DEVICE_GEOMETRY:                     /* Device Geometry */
+        geo.disk_size   = disk.layout_size;
+        geo.iounit_size = disk.iounit_size;
+        geo.track_num   = disk.track_num;
+        memcpy(arg, &geo, sizeof(struct ddriver_geometry));
+        break;
+    case IOC_REQ_DEVICE_CLOCK:                        /* Modeled Device Time */
+        clock_us = atomic_load(&disk.clock_us);
+        memcpy(arg, &clock_us, sizeof(uint64_t));
+        break;
+    case IOC_REQ_DEVICE_SCHED:                        /* Scheduler State */
+        ddriver_sched_state(&sched);
+        memcpy(arg, &sched, sizeof(struct ddriver_sched_state));
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        state.read_cnt = atomic_load(&disk.read_cnt);
+        state.write_cnt = atomic_load(&disk.write_cnt);
+        state.seek_cnt = atomic_load(&disk.seek_cnt);
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        lseek(fd, 0, SEEK_SET);
-        char buf[4096] = {'\0'};
-        for (size_t i = 0; i < CONFIG_DISK_SZ; i += 4096)
-        {
-            write(fd, buf, 4096);
+        ddriver_cache_drop();
+        if (store_reset() < 0) {
+            user_panic("reset error: %s", strerror(errno));
+            return -EIO;
         }
-        lseek(fd, 0, SEEK_SET);
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        cursor = 0;
+        atomic_store(&disk.head, 0);
+        atomic_store(&disk.stats.last_end, 0);
+        ddriver_stats_reset();
+        break;
+    case IOC_REQ_DEVICE_STATS:                        /* Detailed Statistics */
+        ddriver_stats_fill(&stats);
+        memcpy(arg, &stats, sizeof(struct ddriver_stats));
+        break;
+    case IOC_REQ_DEVICE_STATS_RESET:                  /* Reset Statistics Only */
+        ddriver_stats_reset();
+        break;
+    case IOC_REQ_DEVICE_REGIONS:                      /* Register Layout */
+        memcpy(&regions, arg, sizeof(struct ddriver_regions));
+        return ddriver_stats_set_regions(&regions);
+    case IOC_REQ_DEVICE_FLUSH:                        /* Write Back Cache & Sync */
+        return ddriver_flush(fd);
+    case IOC_REQ_DEVICE_DISCARD:                      /* Discard Range */
+        memcpy(&range, arg, sizeof(struct ddriver_range));
+        return ddriver_do_discard(fd, range.offset, range.length);
+    case IOC_REQ_DEVICE_SNAPSHOT:                     /* Save Snapshot */
+        memcpy(&snap, arg, sizeof(struct ddriver_snapshot));
+        snap.path[sizeof(snap.path) - 1] = '\0';
+        return ddriver_snapshot_save(snap.path);
+    case IOC_REQ_DEVICE_RESTORE:                      /* Restore Snapshot */
+        memcpy(&snap, arg, sizeof(struct ddriver_snapshot));
+        snap.path[sizeof(snap.path) - 1] = '\0';
+        return ddriver_snapshot_restore(snap.path);
+    case IOC_REQ_DEVICE_CACHE:                        /* Write Cache State */
+        ddriver_cache_state(&cache);
+        memcpy(arg, &cache, sizeof(struct ddriver_cache_state));
+        break;
+    case IOC_REQ_DEVICE_QUEUES:                       /* Hardware Queue Statistics */
+        ddriver_queue_state(&queues);
+        memcpy(arg, &queues, sizeof(struct ddriver_queues));
+        break;
+    case IOC_REQ_DEVICE_TOPOLOGY:                     /* Device Topology and Capabilities */
+        ddriver_topology(&topo);
+        memcpy(arg, &topo, sizeof(struct ddriver_topology));
+        break;
+    case IOC_REQ_DEVICE_BATCH:                        /* Batched Requests */
+        memcpy(&batch, arg, sizeof(struct ddriver_batch));
+        return ddriver_do_batch(fd, &batch);
+    case IOC_REQ_DEVICE_REAP:                         /* Completed Async Batches */
+        size64 = atomic_exchange(&disk.batch_done, 0);
+        memcpy(arg, &size64, sizeof(uint64_t));
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         memcpy(arg, &disk.iounit_size, sizeof(int));
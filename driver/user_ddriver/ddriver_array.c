@@ -0,0 +1,550 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "string.h"
+#include "errno.h"
+#include <pthread.h>
+#include "ddriver_core.h"
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct array_wait
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  done;
+    int             remaining;
+};
+
+/* 一次请求落在某个成员上的部分，成员上总是一段连续区间 */
+struct array_job
+{
+    int                is_write;
+    struct iovec      *iov;
+    int                iovcnt;
+    off_t              offset;                        /* 成员内偏移 */
+    size_t             total;
+    ssize_t            done;
+    struct array_wait *wait;
+    struct array_job  *next;
+};
+
+/**
+ * 每个成员模拟一个独立的盘片：有自己的磁头与磁道，由自己的线程服务，
+ * 一次请求涉及的各成员并行读写，延迟取最慢的成员
+ */
+struct array_member
+{
+    int               fd;
+    char              path[PATH_MAX];
+    _Atomic off_t     head;
+    _Atomic uint64_t  bytes_read;
+    _Atomic uint64_t  bytes_written;
+    pthread_t         worker;
+    pthread_mutex_t   lock;
+    pthread_cond_t    has_job;
+    struct array_job *jobs;
+    struct array_job *tail;
+};
+
+struct ddriver_array
+{
+    int                 level;                        /* DDRIVER_RAID_* */
+    int                 nr;
+    int                 stop;
+    off_t               chunk_size;
+    off_t               member_size;
+    _Atomic unsigned    rr;                           /* 镜像读的轮转位置 */
+    struct array_member member[DDRIVER_ARRAY_MAX];
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static struct ddriver_array array = {
+    .level = DDRIVER_RAID_NONE,
+    .nr    = 0
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+/**
+ * 求[offset, offset + size)在各成员上的区间，len为0表示不涉及该成员。
+ * 条带化时第c个条带块位于成员c % nr的第c / nr个块，连续的逻辑区间在
+ * 每个成员上也是连续的；镜像时每个成员都是完整的副本
+ */
+static void array_extents(off_t offset, off_t size, off_t start[], off_t len[]) {
+    off_t pos = offset, end = offset + size;
+
+    for (int m = 0; m < array.nr; m++) {
+        start[m] = offset;
+        len[m]   = array.level == DDRIVER_RAID_MIRROR ? size : 0;
+    }
+    if (array.level == DDRIVER_RAID_MIRROR) {
+        return;
+    }
+    while (pos < end) {
+        off_t chunk = pos / array.chunk_size;
+        off_t in    = pos % array.chunk_size;
+        off_t piece = array.chunk_size - in < end - pos ? array.chunk_size - in : end - pos;
+        int   m     = chunk % array.nr;
+
+        if (len[m] == 0)
+            start[m] = (chunk / array.nr) * array.chunk_size + in;
+        len[m] += piece;
+        pos    += piece;
+    }
+}
+
+static void array_job_run(struct array_member *m, struct array_job *job) {
+    int     done_cnt = 0;
+    off_t   offset = job->offset;
+    ssize_t ret;
+
+    job->done = 0;
+    while (done_cnt < job->iovcnt) {
+        int    nr = job->iovcnt - done_cnt < IOV_MAX ? job->iovcnt - done_cnt : IOV_MAX;
+        size_t expect = 0;
+        for (int i = 0; i < nr; i++) {
+            expect += job->iov[done_cnt + i].iov_len;
+        }
+        ret = job->is_write ? pwritev(m->fd, job->iov + done_cnt, nr, offset)
+                            : preadv(m->fd, job->iov + done_cnt, nr, offset);
+        if (ret != (ssize_t)expect) {
+            job->done = -1;
+            return;
+        }
+        job->done += ret;
+        offset    += ret;
+        done_cnt  += nr;
+    }
+    if (job->is_write)
+        atomic_fetch_add_explicit(&m->bytes_written, job->done, memory_order_relaxed);
+    else
+        atomic_fetch_add_explicit(&m->bytes_read, job->done, memory_order_relaxed);
+}
+
+static void *array_worker(void *arg) {
+    struct array_member *m = arg;
+    struct array_job    *job;
+
+    pthread_mutex_lock(&m->lock);
+    for (;;) {
+        while (m->jobs == NULL && !array.stop) {
+            pthread_cond_wait(&m->has_job, &m->lock);
+        }
+        if (m->jobs == NULL) {
+            break;
+        }
+        job     = m->jobs;
+        m->jobs = job->next;
+        if (m->jobs == NULL)
+            m->tail = NULL;
+        pthread_mutex_unlock(&m->lock);
+
+        array_job_run(m, job);
+        pthread_mutex_lock(&job->wait->lock);
+        if (--job->wait->remaining == 0)
+            pthread_cond_signal(&job->wait->done);
+        pthread_mutex_unlock(&job->wait->lock);
+
+        pthread_mutex_lock(&m->lock);
+    }
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+static void array_post(struct array_member *m, struct array_job *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&m->lock);
+    if (m->tail != NULL)
+        m->tail->next = job;
+    else
+        m->jobs = job;
+    m->tail = job;
+    pthread_cond_signal(&m->has_job);
+    pthread_mutex_unlock(&m->lock);
+}
+
+/* 第一个涉及的成员由调用线程自己服务，其余交给成员线程并行执行 */
+static ssize_t array_submit(struct array_job jobs[], ssize_t total) {
+    struct array_wait wait = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .done = PTHREAD_COND_INITIALIZER,
+        .remaining = 0
+    };
+    int     self = -1;
+    ssize_t ret = total;
+
+    for (int m = 0; m < array.nr; m++) {
+        if (jobs[m].iovcnt == 0)
+            continue;
+        if (self < 0) {
+            self = m;
+            continue;
+        }
+        jobs[m].wait = &wait;
+        wait.remaining++;
+        array_post(&array.member[m], &jobs[m]);
+    }
+    if (self >= 0)
+        array_job_run(&array.member[self], &jobs[self]);
+
+    pthread_mutex_lock(&wait.lock);
+    while (wait.remaining > 0) {
+        pthread_cond_wait(&wait.done, &wait.lock);
+    }
+    pthread_mutex_unlock(&wait.lock);
+
+    for (int m = 0; m < array.nr; m++) {
+        if (jobs[m].iovcnt != 0 && jobs[m].done != (ssize_t)jobs[m].total)
+            ret = -1;
+    }
+    return ret;
+}
+
+/* 镜像读选择磁头离目标最近的成员，距离相同时轮流 */
+static int array_mirror_member(off_t offset) {
+    int  first, pick = 0;
+    long best = -1, l;
+
+    first = atomic_fetch_add_explicit(&array.rr, 1, memory_order_relaxed) % array.nr;
+    for (int i = 0; i < array.nr; i++) {
+        int m = (first + i) % array.nr;
+        l = emulate_spindle_lat(array.member_size, atomic_load(&array.member[m].head), offset);
+        if (best < 0 || l < best) {
+            best = l;
+            pick = m;
+        }
+    }
+    return pick;
+}
+
+static ssize_t array_rw(const struct iovec *iov, int iovcnt, off_t offset, int is_write,
+                        int mirror) {
+    struct array_job jobs[DDRIVER_ARRAY_MAX];
+    struct iovec    *segs;
+    size_t           total = 0, cap, koff = 0;
+    off_t            pos, end;
+    int              k = 0;
+    ssize_t          ret;
+
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    memset(jobs, 0, sizeof(jobs));
+
+    if (array.level == DDRIVER_RAID_MIRROR) {
+        /* 镜像写所有成员，读由请求选定的成员承担 */
+        int pick = is_write ? 0 : mirror >= 0 ? mirror : array_mirror_member(offset);
+        for (int m = 0; m < array.nr; m++) {
+            if (!is_write && m != pick)
+                continue;
+            jobs[m].is_write = is_write;
+            jobs[m].iov      = (struct iovec *)iov;
+            jobs[m].iovcnt   = iovcnt;
+            jobs[m].offset   = offset;
+            jobs[m].total    = total;
+        }
+        return array_submit(jobs, total);
+    }
+
+    /* 条带化：按条带块切分iov，每个成员至多 iovcnt + 条带块数 段 */
+    cap  = iovcnt + total / array.chunk_size + 2;
+    segs = malloc(cap * array.nr * sizeof(struct iovec));
+    if (segs == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (int m = 0; m < array.nr; m++) {
+        jobs[m].is_write = is_write;
+        jobs[m].iov      = segs + cap * m;
+    }
+    pos = offset;
+    end = offset + total;
+    while (pos < end) {
+        off_t  chunk = pos / array.chunk_size;
+        off_t  in    = pos % array.chunk_size;
+        size_t piece = array.chunk_size - in < end - pos ? array.chunk_size - in : end - pos;
+        struct array_job *job = &jobs[chunk % array.nr];
+
+        if (job->iovcnt == 0)
+            job->offset = (chunk / array.nr) * array.chunk_size + in;
+        job->total += piece;
+        pos        += piece;
+        while (piece > 0) {
+            size_t len = iov[k].iov_len - koff < piece ? iov[k].iov_len - koff : piece;
+            job->iov[job->iovcnt].iov_base = (char *)iov[k].iov_base + koff;
+            job->iov[job->iovcnt].iov_len  = len;
+            job->iovcnt++;
+            piece -= len;
+            koff  += len;
+            if (koff == iov[k].iov_len) {
+                k++;
+                koff = 0;
+            }
+        }
+    }
+    ret = array_submit(jobs, total);
+    free(segs);
+    return ret;
+}
+
+static long array_member_lat(struct array_member *m, int is_write, off_t start, off_t len) {
+    off_t from = atomic_exchange(&m->head, start + len);
+    long  lat  = emulate_spindle_lat(array.member_size, from, start);
+    if (is_write)
+        return lat + RW_LAT(disk, write, len / disk.iounit_size);
+    return lat + RW_LAT(disk, read, len / disk.iounit_size);
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 按配置打开各成员文件并启动成员线程，由ddriver_open在配置了array时调用
+ *
+ * @param cfg
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_array_open(const struct ddriver_config *cfg) {
+    char        members[PATH_MAX];
+    char       *path, *save = NULL;
+    struct stat st;
+    int         ret = 0;
+
+    array.level       = cfg->raid;
+    array.chunk_size  = cfg->chunk_size;
+    array.nr          = 0;
+    array.stop        = 0;
+    array.member_size = cfg->raid == DDRIVER_RAID_MIRROR ? (off_t)cfg->disk_size
+                                                         : (off_t)cfg->disk_size / cfg->nr_members;
+    atomic_store(&array.rr, 0);
+
+    snprintf(members, sizeof(members), "%s", cfg->members);
+    for (path = strtok_r(members, ",", &save); path != NULL; path = strtok_r(NULL, ",", &save)) {
+        struct array_member *m = &array.member[array.nr];
+
+        snprintf(m->path, sizeof(m->path), "%s", path);
+        m->fd = open(m->path, O_CREAT | O_RDWR, 0644);
+        if (m->fd < 0) {
+            ret = -errno;
+            user_panic("can't open array member [%s]: %s", m->path, strerror(-ret));
+            break;
+        }
+        if (flock(m->fd, LOCK_EX | LOCK_NB) < 0) {
+            user_panic("array member [%s] is in use by another process", m->path);
+            close(m->fd);
+            ret = -EBUSY;
+            break;
+        }
+        if (cfg->flags & DDRIVER_OPEN_PREALLOC) {
+            ret = -posix_fallocate(m->fd, 0, array.member_size);
+        }
+        else if (fstat(m->fd, &st) == 0 && st.st_size < array.member_size) {
+            ret = ftruncate(m->fd, array.member_size) < 0 ? -errno : 0;
+        }
+        if (ret < 0) {
+            user_panic("can't size array member [%s]: %s", m->path, strerror(-ret));
+            close(m->fd);
+            break;
+        }
+        atomic_store(&m->head, 0);
+        atomic_store(&m->bytes_read, 0);
+        atomic_store(&m->bytes_written, 0);
+        m->jobs = m->tail = NULL;
+        pthread_mutex_init(&m->lock, NULL);
+        pthread_cond_init(&m->has_job, NULL);
+        if (pthread_create(&m->worker, NULL, array_worker, m) != 0) {
+            close(m->fd);
+            ret = -EAGAIN;
+            break;
+        }
+        array.nr++;
+    }
+    if (ret < 0) {
+        ddriver_array_close();
+        return ret;
+    }
+    if (array.level == DDRIVER_RAID_MIRROR)
+        user_info("mirror of %d members, %ld bytes each", array.nr, array.member_size);
+    else
+        user_info("stripe of %d members, %ld bytes each, chunk size %ld",
+                  array.nr, array.member_size, array.chunk_size);
+    return 0;
+}
+/**
+ * @brief 停止成员线程并关闭成员文件，由最后一次ddriver_close调用
+ */
+void ddriver_array_close(void) {
+    for (int m = 0; m < array.nr; m++) {
+        pthread_mutex_lock(&array.member[m].lock);
+        array.stop = 1;
+        pthread_cond_signal(&array.member[m].has_job);
+        pthread_mutex_unlock(&array.member[m].lock);
+    }
+    for (int m = 0; m < array.nr; m++) {
+        struct array_member *mb = &array.member[m];
+        pthread_join(mb->worker, NULL);
+        user_info("member %d [%s]: %lu bytes read, %lu bytes written", m, mb->path,
+                  atomic_load(&mb->bytes_read), atomic_load(&mb->bytes_written));
+        close(mb->fd);
+        pthread_mutex_destroy(&mb->lock);
+        pthread_cond_destroy(&mb->has_job);
+    }
+    array.nr    = 0;
+    array.level = DDRIVER_RAID_NONE;
+}
+/**
+ * @brief 是否由多个成员文件组成阵列
+ *
+ * @return int
+ */
+int ddriver_array_active(void) {
+    return array.nr > 0;
+}
+/**
+ * @brief 获取各成员文件的fd
+ *
+ * @param fds 返回fd数组
+ * @return int 成员数
+ */
+int ddriver_array_fds(int fds[]) {
+    for (int m = 0; m < array.nr; m++) {
+        fds[m] = array.member[m].fd;
+    }
+    return array.nr;
+}
+/**
+ * @brief 为一次镜像读选择读数据的成员：磁头离目标最近者，距离相同时轮流。
+ *        每个请求只选一次，同时交给数据读取与延迟模型，计入延迟、移动磁头的
+ *        成员就是实际读数据的成员
+ *
+ * @param is_write
+ * @param offset
+ * @return int 成员号，不是镜像读时返回DDRIVER_MIRROR_ANY
+ */
+int ddriver_array_mirror_member(int is_write, off_t offset) {
+    if (is_write || array.nr == 0 || array.level != DDRIVER_RAID_MIRROR) {
+        return DDRIVER_MIRROR_ANY;
+    }
+    return array_mirror_member(offset);
+}
+/**
+ * @brief 访问[offset, offset + size)的定位与传输延迟，并移动涉及成员的磁头。
+ *        各成员并行定位与传输，取最慢的成员；镜像读只计入实际读数据的成员
+ *
+ * @param is_write
+ * @param offset
+ * @param size
+ * @param mirror 镜像读的成员，见ddriver_array_mirror_member
+ * @return long 延迟 (us)
+ */
+long ddriver_array_lat(int is_write, off_t offset, size_t size, int mirror) {
+    off_t start[DDRIVER_ARRAY_MAX], len[DDRIVER_ARRAY_MAX];
+    long  lat = 0, l;
+
+    if (array.level == DDRIVER_RAID_MIRROR && !is_write) {
+        if (mirror < 0)
+            mirror = array_mirror_member(offset);
+        return array_member_lat(&array.member[mirror], 0, offset, size);
+    }
+    array_extents(offset, size, start, len);
+    for (int m = 0; m < array.nr; m++) {
+        if (len[m] == 0)
+            continue;
+        l = array_member_lat(&array.member[m], is_write, start[m], len[m]);
+        if (l > lat)
+            lat = l;
+    }
+    return lat;
+}
+/**
+ * @brief 读阵列，各成员并行
+ *
+ * @param iov
+ * @param iovcnt
+ * @param offset 逻辑偏移
+ * @param mirror 镜像读的成员，DDRIVER_MIRROR_ANY时当场选择
+ * @return ssize_t 读出的字节数，失败返回-1
+ */
+ssize_t ddriver_array_readv(const struct iovec *iov, int iovcnt, off_t offset, int mirror) {
+    return array_rw(iov, iovcnt, offset, 0, mirror);
+}
+/**
+ * @brief 写阵列，各成员并行
+ *
+ * @param iov
+ * @param iovcnt
+ * @param offset 逻辑偏移
+ * @return ssize_t 写入的字节数，失败返回-1
+ */
+ssize_t ddriver_array_writev(const struct iovec *iov, int iovcnt, off_t offset) {
+    return array_rw(iov, iovcnt, offset, 1, DDRIVER_MIRROR_ANY);
+}
+/**
+ * @brief 清零逻辑区间在各成员上对应的部分
+ *
+ * @param offset
+ * @param size
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_array_zero(off_t offset, off_t size) {
+    off_t start[DDRIVER_ARRAY_MAX], len[DDRIVER_ARRAY_MAX];
+    int   ret;
+
+    array_extents(offset, size, start, len);
+    for (int m = 0; m < array.nr; m++) {
+        if (len[m] == 0)
+            continue;
+        ret = store_zero_fd(array.member[m].fd, start[m], len[m]);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+/**
+ * @brief 清空所有成员，非预分配时截断再扩展
+ *
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_array_reset(void) {
+    for (int m = 0; m < array.nr; m++) {
+        int fd = array.member[m].fd, ret = 0;
+        if (disk.flags & DDRIVER_OPEN_PREALLOC)
+            ret = store_zero_fd(fd, 0, array.member_size);
+        else if (ftruncate(fd, 0) < 0 || ftruncate(fd, array.member_size) < 0)
+            ret = -errno;
+        if (ret < 0)
+            return ret;
+        atomic_store(&array.member[m].head, 0);
+    }
+    return 0;
+}
+/**
+ * @brief 同步所有成员文件
+ *
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_array_sync(void) {
+    for (int m = 0; m < array.nr; m++) {
+        if (fsync(array.member[m].fd) < 0)
+            return -errno;
+    }
+    return 0;
+}
+/**
+ * @brief 修正阵列的拓扑：条带化时最优请求为整条带，使每个成员各传输一个条带块；
+ *        各成员可以并行服务，相当于成员数个队列
+ *
+ * @param topo
+ */
+void ddriver_array_topology(struct ddriver_topology *topo) {
+    if (array.nr == 0) {
+        return;
+    }
+    topo->nr_queues = array.nr;
+    if (array.level == DDRIVER_RAID_STRIPE) {
+        topo->optimal_io_size = array.chunk_size * array.nr;
+    }
+}
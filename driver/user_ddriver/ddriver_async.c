@@ -0,0 +1,399 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include "string.h"
+#include "errno.h"
+#include <pthread.h>
+#include <time.h>
+#include "ddriver_core.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define ENV_ASYNC_WORKERS       "DDRIVER_ASYNC_WORKERS"  /* 异步工作线程数 */
+#define ASYNC_WORKERS_DEFAULT   4
+#define ASYNC_WORKERS_MAX       64
+#define ASYNC_MERGE_MAX         64                       /* 一次合并的最多请求数 */
+#define DEADLINE_READ_NS        (500 * 1000 * 1000ULL)   /* 读请求500ms到期 */
+#define DEADLINE_WRITE_NS       (5000 * 1000 * 1000ULL)  /* 写请求5s到期 */
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct async_entry
+{
+    struct ddriver_req* req;
+    uint64_t            expire;                       /* deadline策略下的到期时间 */
+};
+/**
+ * 提交队列按提交顺序存放，调度策略从中任选一个请求派发，并把与之
+ * 首尾相接的同向请求合并为一次访问；完成队列为环形队列。两者容量均为
+ * DDRIVER_ASYNC_DEPTH，inflight统计 已提交 + 执行中 + 已完成未收割 的
+ * 请求数，不超过容量，因此两个队列都不会溢出
+ */
+struct ddriver_async
+{
+    int                 fd;
+    int                 started;
+    int                 stop;
+    int                 nr_workers;
+    pthread_t           workers[ASYNC_WORKERS_MAX];
+    pthread_mutex_t     lock;
+    pthread_cond_t      has_pending;
+    pthread_cond_t      has_done;
+    struct async_entry  pending[DDRIVER_ASYNC_DEPTH];
+    int                 pending_cnt;
+    struct ddriver_req* done[DDRIVER_ASYNC_DEPTH];
+    int                 done_head;
+    int                 done_cnt;
+    int                 inflight;
+    int                 dir;                          /* elevator扫描方向 */
+    off_t               sched_head;                   /* 按派发顺序的磁头位置 */
+    off_t               fifo_head;                    /* 按提交顺序的磁头位置 */
+    struct ddriver_sched_state stat;
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static struct ddriver_async aio = {
+    .fd          = -1,
+    .started     = 0,
+    .stop        = 0,
+    .nr_workers  = 0,
+    .lock        = PTHREAD_MUTEX_INITIALIZER,
+    .has_pending = PTHREAD_COND_INITIALIZER,
+    .has_done    = PTHREAD_COND_INITIALIZER,
+    .dir         = 1
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 沿dir方向离from最近的请求，没有则返回-1 */
+static int sched_nearest(off_t from, int dir) {
+    int best = -1;
+    for (int i = 0; i < aio.pending_cnt; i++) {
+        off_t off = aio.pending[i].req->offset;
+        if (dir > 0 ? off < from : off > from) {
+            continue;
+        }
+        if (best < 0 || (dir > 0 ? off < aio.pending[best].req->offset
+                                 : off > aio.pending[best].req->offset)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static int sched_pick(void) {
+    int i;
+    switch (disk.sched)
+    {
+    case DDRIVER_SCHED_ELEVATOR:                      /* LOOK：到头后反向 */
+        i = sched_nearest(aio.sched_head, aio.dir);
+        if (i < 0) {
+            aio.dir = -aio.dir;
+            i = sched_nearest(aio.sched_head, aio.dir);
+        }
+        return i;
+    case DDRIVER_SCHED_DEADLINE:                      /* 最老的请求到期则先服务它，否则单向扫描 */
+        if (now_ns() >= aio.pending[0].expire) {
+            aio.stat.expired++;
+            return 0;
+        }
+        i = sched_nearest(aio.sched_head, 1);
+        return i < 0 ? sched_nearest(0, 1) : i;
+    default:                                          /* noop：按提交顺序 */
+        return 0;
+    }
+}
+
+static struct ddriver_req *sched_take(int i) {
+    struct ddriver_req *req = aio.pending[i].req;
+    memmove(&aio.pending[i], &aio.pending[i + 1], 
+            (aio.pending_cnt - i - 1) * sizeof(struct async_entry));
+    aio.pending_cnt--;
+    return req;
+}
+
+/* 提交时检查单个请求，不合法的请求直接完成，不会进入队列与合法请求合并 */
+static int async_check(const struct ddriver_req *req) {
+    struct iovec iov = { .iov_base = req->buf, .iov_len = req->size };
+    size_t total;
+    int    res;
+
+    if (req->op == DDRIVER_OP_DISCARD) {
+        if (req->size == 0 || req->size % disk.iounit_size != 0) {
+            user_alert("discard size %ld should align to %d", req->size, disk.iounit_size);
+            return -EINVAL;
+        }
+        return check_range(req->offset, req->size);
+    }
+    if (req->op != DDRIVER_OP_READ && req->op != DDRIVER_OP_WRITE && 
+        req->op != DDRIVER_OP_WRITE_FUA) {
+        user_alert("unknown async op %d", req->op);
+        return -EINVAL;
+    }
+    res = check_iov(&iov, 1, &total);
+    if (res < 0)
+        return res;
+    return check_range(req->offset, total);
+}
+
+static void async_complete(struct ddriver_req *req, int res) {
+    req->res = res;
+    aio.done[(aio.done_head + aio.done_cnt) % DDRIVER_ASYNC_DEPTH] = req;
+    aio.done_cnt++;
+}
+
+/* 取出下一个请求，并合并其后首尾相接的同向请求，合并后不超过单次最大传输量，返回合并的请求数 */
+static int sched_dispatch(struct ddriver_req **batch) {
+    int    nr = 0;
+    off_t  end;
+
+    batch[nr++] = sched_take(sched_pick());
+    end = batch[0]->offset + batch[0]->size;
+    while (nr < ASYNC_MERGE_MAX && nr < IOV_MAX) {
+        int i;
+        for (i = 0; i < aio.pending_cnt; i++) {
+            if (aio.pending[i].req->op == batch[0]->op && 
+                aio.pending[i].req->offset == end &&
+                end - batch[0]->offset + aio.pending[i].req->size <= CONFIG_MAX_TRANSFER) {
+                break;
+            }
+        }
+        if (i == aio.pending_cnt) {
+            break;
+        }
+        batch[nr++] = sched_take(i);
+        end += batch[nr - 1]->size;
+    }
+    aio.stat.sched_pos_us += emulate_position_lat(aio.sched_head, batch[0]->offset);
+    aio.stat.dispatched++;
+    aio.stat.merged += nr - 1;
+    aio.sched_head = end;
+    return nr;
+}
+
+static void *async_worker(void *arg) {
+    struct ddriver_req *batch[ASYNC_MERGE_MAX];
+    struct iovec        iov[ASYNC_MERGE_MAX];
+    int                 nr, res;
+    off_t               size;
+    IGNORE_ARG(arg);
+
+    pthread_mutex_lock(&aio.lock);
+    for (;;) {
+        while (aio.pending_cnt == 0 && !aio.stop) {
+            pthread_cond_wait(&aio.has_pending, &aio.lock);
+        }
+        if (aio.pending_cnt == 0) {                   /* stop且已排空 */
+            break;
+        }
+        nr = sched_dispatch(batch);
+        pthread_mutex_unlock(&aio.lock);
+
+        size = 0;
+        for (int i = 0; i < nr; i++) {
+            iov[i].iov_base = batch[i]->buf;
+            iov[i].iov_len  = batch[i]->size;
+            size           += batch[i]->size;
+        }
+        if (batch[0]->op == DDRIVER_OP_DISCARD)
+            res = ddriver_do_discard(aio.fd, batch[0]->offset, size);
+        else
+            res = ddriver_do_rw(aio.fd, batch[0]->op, iov, nr, batch[0]->offset);
+
+        pthread_mutex_lock(&aio.lock);
+        for (int i = 0; i < nr; i++) {
+            async_complete(batch[i], res < 0 ? res : (int)batch[i]->size);
+        }
+        pthread_cond_broadcast(&aio.has_done);
+    }
+    pthread_mutex_unlock(&aio.lock);
+    return NULL;
+}
+
+static int async_start(int fd) {
+    char *env = getenv(ENV_ASYNC_WORKERS);
+    int   nr  = env ? atoi(env) : ASYNC_WORKERS_DEFAULT;
+    IGNORE_ARG(fd);
+
+    if (nr <= 0 || nr > ASYNC_WORKERS_MAX) {
+        nr = ASYNC_WORKERS_DEFAULT;
+    }
+    aio.fd           = disk.ddriver_fd;                  /* 提交者的fd可能先于设备关闭 */
+    aio.stop         = 0;
+    aio.pending_cnt  = 0;
+    aio.done_head    = aio.done_cnt    = 0;
+    aio.inflight     = 0;
+    aio.dir          = 1;
+    aio.sched_head   = aio.fifo_head   = atomic_load(&disk.head);
+    for (aio.nr_workers = 0; aio.nr_workers < nr; aio.nr_workers++) {
+        if (pthread_create(&aio.workers[aio.nr_workers], NULL,
+                           async_worker, NULL) != 0) {
+            break;
+        }
+    }
+    if (aio.nr_workers == 0) {
+        user_panic("can't start async workers: %s", strerror(errno));
+        return -EAGAIN;
+    }
+    aio.started = 1;
+    return 0;
+}
+
+static int async_reap(struct ddriver_req **done, int max) {
+    int nr = 0;
+    while (nr < max && aio.done_cnt > 0) {
+        done[nr++] = aio.done[aio.done_head];
+        aio.done_head = (aio.done_head + 1) % DDRIVER_ASYNC_DEPTH;
+        aio.done_cnt--;
+        aio.inflight--;
+    }
+    return nr;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 批量提交异步读写请求，由工作线程池并发执行。同一设备的所有
+ *        文件描述符共享一个队列，可被多线程并发调用
+ *
+ * @param fd
+ * @param reqs 请求数组，完成前调用者须保证其有效
+ * @param nr
+ * @return int 接受的请求数，在途请求达到DDRIVER_ASYNC_DEPTH时可能少于nr；
+ *             失败返回负的错误号。不合法的请求同样被接受，并立即以负的错误号完成
+ */
+int ddriver_async_submit(int fd, struct ddriver_req *reqs, int nr) {
+    int ret = 0, accepted = 0, queued = 0, failed = 0;
+
+    pthread_mutex_lock(&aio.lock);
+    if (!aio.started) {
+        ret = async_start(fd);
+    }
+    if (ret < 0) {
+        pthread_mutex_unlock(&aio.lock);
+        return ret;
+    }
+    while (accepted < nr && aio.inflight < DDRIVER_ASYNC_DEPTH) {
+        struct ddriver_req *req = &reqs[accepted++];
+        struct async_entry *ent;
+        int bad = async_check(req);
+        aio.inflight++;
+        if (bad < 0) {
+            async_complete(req, bad);
+            failed++;
+            continue;
+        }
+        ent         = &aio.pending[aio.pending_cnt++];
+        req->res    = -EINPROGRESS;
+        ent->req    = req;
+        ent->expire = now_ns() + (req->op != DDRIVER_OP_READ ? DEADLINE_WRITE_NS
+                                                              : DEADLINE_READ_NS);
+        queued++;
+        /* 同样的请求若按提交顺序服务，定位代价是多少 */
+        aio.stat.fifo_pos_us += emulate_position_lat(aio.fifo_head, req->offset);
+        aio.fifo_head = req->offset + req->size;
+        aio.stat.submitted++;
+    }
+    if (queued > 0) {
+        pthread_cond_broadcast(&aio.has_pending);
+    }
+    if (failed > 0) {
+        pthread_cond_broadcast(&aio.has_done);
+    }
+    pthread_mutex_unlock(&aio.lock);
+    return accepted;
+}
+/**
+ * @brief 收割已完成的请求，不阻塞
+ *
+ * @param fd
+ * @param done 输出已完成请求的指针
+ * @param max done的容量
+ * @return int 收割的请求数
+ */
+int ddriver_async_poll(int fd, struct ddriver_req **done, int max) {
+    int nr;
+    IGNORE_ARG(fd);
+
+    pthread_mutex_lock(&aio.lock);
+    nr = async_reap(done, max);
+    pthread_mutex_unlock(&aio.lock);
+    return nr;
+}
+/**
+ * @brief 等待至少min个请求完成后收割
+ *
+ * @param fd
+ * @param done 输出已完成请求的指针
+ * @param min 若超过在途请求数，则只等待全部在途请求
+ * @param max done的容量
+ * @return int 收割的请求数
+ */
+int ddriver_async_wait(int fd, struct ddriver_req **done, int min, int max) {
+    int nr;
+    IGNORE_ARG(fd);
+
+    pthread_mutex_lock(&aio.lock);
+    if (min > aio.inflight) {
+        min = aio.inflight;
+    }
+    if (min > max) {
+        min = max;
+    }
+    while (aio.done_cnt < min) {
+        pthread_cond_wait(&aio.has_done, &aio.lock);
+    }
+    nr = async_reap(done, max);
+    pthread_mutex_unlock(&aio.lock);
+    return nr;
+}
+/**
+ * @brief 执行完所有已提交的请求后停止工作线程，由最后一次ddriver_close调用
+ *
+ * @param fd
+ */
+void ddriver_async_stop(int fd) {
+    IGNORE_ARG(fd);
+
+    pthread_mutex_lock(&aio.lock);
+    if (!aio.started) {
+        pthread_mutex_unlock(&aio.lock);
+        return;
+    }
+    aio.stop = 1;
+    pthread_cond_broadcast(&aio.has_pending);
+    pthread_mutex_unlock(&aio.lock);
+
+    for (int i = 0; i < aio.nr_workers; i++) {
+        pthread_join(aio.workers[i], NULL);
+    }
+    aio.started = 0;
+    aio.fd      = -1;
+}
+/**
+ * @brief 读取调度统计
+ *
+ * @param state
+ */
+void ddriver_sched_state(struct ddriver_sched_state *state) {
+    pthread_mutex_lock(&aio.lock);
+    *state = aio.stat;
+    state->policy = disk.sched;
+    pthread_mutex_unlock(&aio.lock);
+}
+/**
+ * @brief 清零调度统计，由IOC_REQ_DEVICE_RESET调用
+ */
+void ddriver_sched_reset(void) {
+    pthread_mutex_lock(&aio.lock);
+    memset(&aio.stat, 0, sizeof(aio.stat));
+    aio.sched_head = aio.fifo_head = 0;
+    pthread_mutex_unlock(&aio.lock);
+}
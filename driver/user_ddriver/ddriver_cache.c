@@ -0,0 +1,431 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "errno.h"
+#include <pthread.h>
+#include "ddriver_core.h"
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+/**
+ * 易失写缓存：以IO单位为粒度缓存尚未落盘的写，按块号哈希查找。
+ * 槽位按顺序分配，写回 (destage) 时按偏移排序、合并相邻块后一次性
+ * 全部写回并清空，因此只需记录已用槽位数，无需空闲链表；被discard
+ * 的槽位偏移置为-1，留到下次清空时回收
+ */
+struct cache_slot
+{
+    off_t offset;
+    int   next;                                       /* 哈希链，-1结束 */
+};
+
+struct ddriver_cache
+{
+    int                 enabled;
+    uint32_t            nr_slots;
+    uint32_t            nr_used;
+    uint32_t            nr_dead;                      /* 被discard作废的槽位 */
+    uint32_t            bucket_mask;
+    int                *bucket;
+    int                *order;                        /* 写回时的排序缓冲 */
+    struct cache_slot  *slot;
+    char               *data;
+    pthread_mutex_t     lock;
+    struct ddriver_cache_state stat;
+};
+
+/* 一次写回中合并后的一次访问，释放cache.lock后再计入统计、轨迹与延迟 */
+struct cache_run
+{
+    off_t  offset;
+    size_t size;
+    long   lat;
+};
+
+struct cache_destage
+{
+    struct cache_run *run;
+    uint32_t          nr;
+    uint32_t          cap;
+    struct cache_run  one;                            /* 分配失败时合并为一次 */
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static struct ddriver_cache cache = {
+    .enabled = 0,
+    .lock    = PTHREAD_MUTEX_INITIALIZER
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+#define SLOT_DATA(i)            (cache.data + (size_t)(i) * disk.iounit_size)
+
+static uint32_t cache_hash(off_t offset) {
+    uint64_t blk = offset / disk.iounit_size;
+    return (uint32_t)(blk * 0x9E3779B97F4A7C15ULL >> 32) & cache.bucket_mask;
+}
+
+static int cache_find(off_t offset) {
+    int i = cache.bucket[cache_hash(offset)];
+    while (i >= 0 && cache.slot[i].offset != offset) {
+        i = cache.slot[i].next;
+    }
+    return i;
+}
+
+static int cache_alloc(off_t offset) {
+    uint32_t h = cache_hash(offset);
+    int      i = cache.nr_used++;
+
+    cache.slot[i].offset = offset;
+    cache.slot[i].next   = cache.bucket[h];
+    cache.bucket[h]      = i;
+    return i;
+}
+
+static void cache_clear(void) {
+    memset(cache.bucket, 0xff, (cache.bucket_mask + 1) * sizeof(int));
+    cache.nr_used = 0;
+    cache.nr_dead = 0;
+}
+
+static int cache_cmp(const void *a, const void *b) {
+    off_t x = cache.slot[*(const int *)a].offset;
+    off_t y = cache.slot[*(const int *)b].offset;
+    return x < y ? -1 : x > y;
+}
+
+static void cache_run_add(struct cache_destage *d, off_t offset, size_t size, long lat) {
+    if (d->nr == d->cap) {
+        d->run[d->nr - 1].size += size;
+        d->run[d->nr - 1].lat  += lat;
+        return;
+    }
+    d->run[d->nr].offset = offset;
+    d->run[d->nr].size   = size;
+    d->run[d->nr].lat    = lat;
+    d->nr++;
+}
+
+/**
+ * 按偏移顺序写回全部脏块，首尾相接的块合并为一次访问。每次访问的
+ * 代价与普通写相同：定位 + 请求开销 + 传输。调用者持有cache.lock，
+ * 这里只写数据、移动磁头并把各次访问记入d，由cache_destage_account
+ * 在释放锁后计入，写回的延迟不阻塞其他访问缓存的线程
+ */
+static int cache_destage_locked(struct cache_destage *d) {
+    struct iovec iov[IOV_MAX];
+    uint32_t     i = 0;
+    int          ret = 0;
+
+    if (cache.nr_used == 0) {
+        return 0;
+    }
+    d->run = malloc(cache.nr_used * sizeof(struct cache_run));
+    d->nr  = 0;
+    d->cap = cache.nr_used;
+    if (d->run == NULL) {
+        d->run = &d->one;
+        d->cap = 1;
+    }
+    for (uint32_t k = 0; k < cache.nr_used; k++) {
+        cache.order[k] = k;
+    }
+    qsort(cache.order, cache.nr_used, sizeof(int), cache_cmp);
+    i = cache.nr_dead;                                /* 作废的槽位排在最前 */
+
+    while (i < cache.nr_used) {
+        off_t  start = cache.slot[cache.order[i]].offset;
+        int    nr = 0;
+        size_t total;
+
+        while (i < cache.nr_used && nr < IOV_MAX &&
+               cache.slot[cache.order[i]].offset == start + (off_t)nr * disk.iounit_size) {
+            iov[nr].iov_base = SLOT_DATA(cache.order[i]);
+            iov[nr].iov_len  = disk.iounit_size;
+            nr++;
+            i++;
+        }
+        total = (size_t)nr * disk.iounit_size;
+        if (store_writev(disk.ddriver_fd, iov, nr, start) != (ssize_t)total) {
+            user_panic("destage error: %s", strerror(errno));
+            ret = -EIO;
+            continue;
+        }
+        cache_run_add(d, start, total, emulate_access_lat(1, start, total, DDRIVER_MIRROR_ANY));
+        cache.stat.destages++;
+        cache.stat.destaged_bytes += total;
+    }
+    cache_clear();
+    return ret;
+}
+
+/* 在cache.lock之外像普通写一样计入写回的各次访问并休眠 */
+static void cache_destage_account(struct cache_destage *d) {
+    for (uint32_t k = 0; k < d->nr; k++) {
+        ddriver_stats_account(1, d->run[k].offset, d->run[k].size, d->run[k].lat);
+        ddriver_trace_record(DDRIVER_OP_DESTAGE, d->run[k].offset, d->run[k].size, d->run[k].lat);
+        ddriver_delay(d->run[k].lat);
+    }
+    if (d->run != &d->one)
+        free(d->run);
+}
+
+/* 用iov中的数据刷新已缓存的块，alloc非0时为未缓存的块分配槽位，缓存满时写回到d */
+static int cache_fill_locked(const struct iovec *iov, int iovcnt, off_t offset, int alloc,
+                             struct cache_destage *d) {
+    int ret = 0;
+
+    for (int k = 0; k < iovcnt; k++) {
+        for (size_t done = 0; done < iov[k].iov_len; done += disk.iounit_size) {
+            int s = cache_find(offset);
+            if (s >= 0) {
+                if (alloc)
+                    cache.stat.write_hits++;
+            }
+            else if (alloc) {
+                if (cache.nr_used == cache.nr_slots) {
+                    ret = cache_destage_locked(d);
+                }
+                s = cache_alloc(offset);
+            }
+            if (s >= 0) {
+                memcpy(SLOT_DATA(s), (char *)iov[k].iov_base + done, disk.iounit_size);
+            }
+            offset += disk.iounit_size;
+        }
+    }
+    return ret;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 建立写缓存，由ddriver_open在配置了wcache时调用
+ *
+ * @param size 缓存大小，向下取整到IO单位，0表示不启用
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_cache_init(uint64_t size) {
+    uint32_t nr = size / disk.iounit_size, buckets = 1;
+
+    cache.enabled = 0;
+    if (nr == 0) {
+        return 0;
+    }
+    while (buckets < nr) {
+        buckets <<= 1;
+    }
+    cache.nr_slots    = nr;
+    cache.bucket_mask = buckets - 1;
+    cache.bucket      = malloc(buckets * sizeof(int));
+    cache.order       = malloc(nr * sizeof(int));
+    cache.slot        = malloc(nr * sizeof(struct cache_slot));
+    cache.data        = malloc((size_t)nr * disk.iounit_size);
+    if (!cache.bucket || !cache.order || !cache.slot || !cache.data) {
+        ddriver_cache_destroy();
+        return -ENOMEM;
+    }
+    cache_clear();
+    memset(&cache.stat, 0, sizeof(cache.stat));
+    cache.stat.size = (uint64_t)nr * disk.iounit_size;
+    cache.enabled   = 1;
+    return 0;
+}
+/**
+ * @brief 释放写缓存，调用前应先ddriver_cache_flush，否则脏数据丢失
+ */
+void ddriver_cache_destroy(void) {
+    cache.enabled = 0;
+    free(cache.bucket);
+    free(cache.order);
+    free(cache.slot);
+    free(cache.data);
+    cache.bucket = cache.order = NULL;
+    cache.slot   = NULL;
+    cache.data   = NULL;
+    cache.stat.size = 0;
+}
+/**
+ * @brief 是否启用了写缓存
+ *
+ * @return int
+ */
+int ddriver_cache_enabled(void) {
+    return cache.enabled;
+}
+/**
+ * @brief 写缓存是否可以接收该请求，超过缓存容量的请求直写
+ *
+ * @param size
+ * @return int
+ */
+int ddriver_cache_absorbs(size_t size) {
+    return cache.enabled && size / disk.iounit_size <= cache.nr_slots;
+}
+/**
+ * @brief 写入缓存，缓存满时先写回全部脏块
+ *
+ * @param iov
+ * @param iovcnt
+ * @param offset
+ * @return int 0成功，写回失败返回负的错误号
+ */
+int ddriver_cache_write(const struct iovec *iov, int iovcnt, off_t offset) {
+    struct cache_destage d = { .run = NULL, .nr = 0 };
+    int ret;
+
+    pthread_mutex_lock(&cache.lock);
+    ret = cache_fill_locked(iov, iovcnt, offset, 1, &d);
+    pthread_mutex_unlock(&cache.lock);
+    cache_destage_account(&d);
+    return ret;
+}
+/**
+ * @brief 绕过缓存直接写入 (FUA或超大请求)，并刷新已缓存的旧副本，
+ *        避免之后的写回用旧数据覆盖
+ *
+ * @param iov
+ * @param iovcnt
+ * @param offset
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_cache_write_through(const struct iovec *iov, int iovcnt, off_t offset) {
+    ssize_t done;
+    size_t  total = 0;
+
+    for (int k = 0; k < iovcnt; k++) {
+        total += iov[k].iov_len;
+    }
+    pthread_mutex_lock(&cache.lock);
+    done = store_writev(disk.ddriver_fd, iov, iovcnt, offset);
+    if (done == (ssize_t)total) {
+        cache_fill_locked(iov, iovcnt, offset, 0, NULL);
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return done == (ssize_t)total ? 0 : -EIO;
+}
+/**
+ * @brief 读取，所有块都在缓存中时直接由缓存服务；否则从后端读出后
+ *        用缓存中较新的块覆盖
+ *
+ * @param iov
+ * @param iovcnt
+ * @param offset
+ * @param total 请求总字节数
+ * @param mirror 未命中时读数据的镜像成员
+ * @return int 1命中，0未命中，失败返回负的错误号
+ */
+int ddriver_cache_read(const struct iovec *iov, int iovcnt, off_t offset, size_t total, 
+                       int mirror) {
+    int   hit = 1;
+    off_t pos = offset;
+
+    pthread_mutex_lock(&cache.lock);
+    for (off_t end = offset + total; hit && pos < end; pos += disk.iounit_size) {
+        hit = cache_find(pos) >= 0;
+    }
+    if (!hit && store_readv(disk.ddriver_fd, iov, iovcnt, offset, mirror) != (ssize_t)total) {
+        pthread_mutex_unlock(&cache.lock);
+        return -EIO;
+    }
+    pos = offset;
+    for (int k = 0; k < iovcnt; k++) {
+        for (size_t done = 0; done < iov[k].iov_len; done += disk.iounit_size) {
+            int s = cache_find(pos);
+            if (s >= 0) {
+                memcpy((char *)iov[k].iov_base + done, SLOT_DATA(s), disk.iounit_size);
+            }
+            pos += disk.iounit_size;
+        }
+    }
+    if (hit) {
+        cache.stat.read_hits++;
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return hit;
+}
+/**
+ * @brief 写回全部脏块，由ddriver_flush与最后一次ddriver_close调用
+ *
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_cache_flush(void) {
+    struct cache_destage d = { .run = NULL, .nr = 0 };
+    int ret;
+
+    if (!cache.enabled) {
+        return 0;
+    }
+    pthread_mutex_lock(&cache.lock);
+    cache.stat.flushes++;
+    ret = cache_destage_locked(&d);
+    pthread_mutex_unlock(&cache.lock);
+    cache_destage_account(&d);
+    return ret;
+}
+/**
+ * @brief 丢弃区间内的脏块，由discard调用
+ *
+ * @param offset
+ * @param size
+ */
+void ddriver_cache_discard(off_t offset, off_t size) {
+    if (!cache.enabled) {
+        return;
+    }
+    pthread_mutex_lock(&cache.lock);
+    memset(cache.bucket, 0xff, (cache.bucket_mask + 1) * sizeof(int));
+    for (uint32_t i = 0; i < cache.nr_used; i++) {
+        struct cache_slot *slot = &cache.slot[i];
+        uint32_t h;
+        if (slot->offset < 0) {
+            continue;
+        }
+        if (slot->offset >= offset && slot->offset < offset + size) {
+            slot->offset = -1;
+            cache.nr_dead++;
+            continue;
+        }
+        h = cache_hash(slot->offset);
+        slot->next      = cache.bucket[h];
+        cache.bucket[h] = i;
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+/**
+ * @brief 丢弃全部脏块，由IOC_REQ_DEVICE_RESET调用
+ */
+void ddriver_cache_drop(void) {
+    if (!cache.enabled) {
+        return;
+    }
+    pthread_mutex_lock(&cache.lock);
+    cache_clear();
+    pthread_mutex_unlock(&cache.lock);
+}
+/**
+ * @brief 读取缓存统计
+ *
+ * @param state
+ */
+void ddriver_cache_state(struct ddriver_cache_state *state) {
+    pthread_mutex_lock(&cache.lock);
+    *state = cache.stat;
+    state->dirty = cache.enabled ? (uint64_t)(cache.nr_used - cache.nr_dead) * disk.iounit_size 
+                                 : 0;
+    pthread_mutex_unlock(&cache.lock);
+}
+/**
+ * @brief 清零缓存统计，由ddriver_stats_reset调用
+ */
+void ddriver_cache_reset(void) {
+    uint64_t size;
+
+    pthread_mutex_lock(&cache.lock);
+    size = cache.stat.size;
+    memset(&cache.stat, 0, sizeof(cache.stat));
+    cache.stat.size = size;
+    pthread_mutex_unlock(&cache.lock);
+}
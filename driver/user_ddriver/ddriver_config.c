@@ -0,0 +1,330 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <ctype.h>
+#include "errno.h"
+#include "ddriver_core.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define ENV_PREFIX          "DDRIVER_"
+#define ENV_CONFIG          "DDRIVER_CONFIG"          /* 配置文件路径 */
+#define CONFIG_LINE_LEN     256
+#define CONFIG_IOUNIT_MAX   (1024 * 1024)
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+/**
+ * 配置项既可写在DDRIVER_CONFIG指向的文件中 (每行 key = value，#开头为注释)，
+ * 也可通过环境变量 DDRIVER_<KEY大写> 指定，环境变量优先
+ */
+static const char *config_keys[] = {
+    "disk_sz",                                        /* 设备大小，支持K/M/G/T后缀 */
+    "io_sz",                                          /* IO单位大小 */
+    "track_num",                                      /* 磁道数 */
+    "mmap",                                           /* 非0时以mmap方式打开 */
+    "nodelay",                                        /* 非0时不模拟延迟 */
+    "simclock",                                       /* 非0时只推进模拟时钟，不休眠 */
+    "sched",                                          /* 异步请求调度策略：noop/elevator/deadline */
+    "trace",                                          /* 请求轨迹文件路径，为目录时写入其中的<设备名>.trace */
+    "wcache",                                         /* 易失写缓存大小，0不启用 */
+    "prealloc",                                       /* 非0时预分配后端文件，否则为稀疏文件 */
+    "direct",                                         /* 非0时以O_DIRECT访问后端文件，绕过宿主页缓存 */
+    "array",                                          /* 多文件阵列：stripe[:条带块大小]:文件,... 或 mirror:文件,... */
+    "queues",                                         /* 硬件队列数，非0时模拟多队列设备 */
+    "qdepth",                                         /* 每个硬件队列的深度 */
+    "profile",                                        /* 设备档案：hdd/sata-ssd/nvme/sdcard或档案文件 */
+    "read_lat",                                       /* 覆盖档案的读开销：p50 [p99 [p999]] (us) */
+    "write_lat",                                      /* 覆盖档案的写开销 */
+    "slow",                                           /* 慢区间：起始 大小 倍数，多个以';'分隔 */
+    "seed",                                           /* 延迟抽样的随机种子 */
+    NULL
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+/* 解析 stripe[:chunk]:a,b,... 或 mirror:a,b,... */
+static void config_set_array(struct ddriver_config *cfg, const char *val) {
+    const char *rest = strchr(val, ':');
+    const char *sep;
+
+    cfg->raid       = DDRIVER_RAID_NONE;
+    cfg->nr_members = 0;
+    cfg->members[0] = '\0';
+    if (strcmp(val, "none") == 0 || *val == '\0') {
+        return;
+    }
+    if (rest == NULL) {
+        user_panic("bad array spec [%s]", val);
+        return;
+    }
+    if (strncmp(val, "stripe:", 7) == 0) {
+        cfg->raid = DDRIVER_RAID_STRIPE;
+        sep = strchr(rest + 1, ':');
+        if (isdigit((unsigned char)rest[1]) && sep != NULL) {
+            cfg->chunk_size = ddriver_parse_size(rest + 1);
+            rest = sep;
+        }
+    }
+    else if (strncmp(val, "mirror:", 7) == 0) {
+        cfg->raid = DDRIVER_RAID_MIRROR;
+    }
+    else {
+        user_panic("unknown array level [%s]", val);
+        return;
+    }
+    snprintf(cfg->members, sizeof(cfg->members), "%s", rest + 1);
+    cfg->nr_members = 1;
+    for (const char *p = cfg->members; *p; p++) {
+        if (*p == ',')
+            cfg->nr_members++;
+    }
+}
+
+static void config_set(struct ddriver_config *cfg, const char *key, const char *val) {
+    if (strcmp(key, "disk_sz") == 0) {
+        cfg->disk_size = ddriver_parse_size(val);
+    }
+    else if (strcmp(key, "io_sz") == 0) {
+        cfg->iounit_size = (uint32_t)ddriver_parse_size(val);
+    }
+    else if (strcmp(key, "track_num") == 0) {
+        cfg->track_num = (uint32_t)strtoul(val, NULL, 0);
+    }
+    else if (strcmp(key, "mmap") == 0) {
+        if (atoi(val) != 0)
+            cfg->flags |= DDRIVER_OPEN_MMAP;
+        else
+            cfg->flags &= ~DDRIVER_OPEN_MMAP;
+    }
+    else if (strcmp(key, "nodelay") == 0) {
+        if (atoi(val) != 0)
+            cfg->flags |= DDRIVER_OPEN_NODELAY;
+        else
+            cfg->flags &= ~DDRIVER_OPEN_NODELAY;
+    }
+    else if (strcmp(key, "simclock") == 0) {
+        if (atoi(val) != 0)
+            cfg->flags |= DDRIVER_OPEN_SIMCLOCK;
+        else
+            cfg->flags &= ~DDRIVER_OPEN_SIMCLOCK;
+    }
+    else if (strcmp(key, "sched") == 0) {
+        if (strcmp(val, "noop") == 0)
+            cfg->sched = DDRIVER_SCHED_NOOP;
+        else if (strcmp(val, "elevator") == 0)
+            cfg->sched = DDRIVER_SCHED_ELEVATOR;
+        else if (strcmp(val, "deadline") == 0)
+            cfg->sched = DDRIVER_SCHED_DEADLINE;
+        else
+            user_panic("unknown scheduler [%s]", val);
+    }
+    else if (strcmp(key, "trace") == 0) {
+        snprintf(cfg->trace, sizeof(cfg->trace), "%s", val);
+    }
+    else if (strcmp(key, "prealloc") == 0) {
+        if (atoi(val) != 0)
+            cfg->flags |= DDRIVER_OPEN_PREALLOC;
+        else
+            cfg->flags &= ~DDRIVER_OPEN_PREALLOC;
+    }
+    else if (strcmp(key, "direct") == 0) {
+        if (atoi(val) != 0)
+            cfg->flags |= DDRIVER_OPEN_DIRECT;
+        else
+            cfg->flags &= ~DDRIVER_OPEN_DIRECT;
+    }
+    else if (strcmp(key, "queues") == 0) {
+        cfg->nr_queues = atoi(val);
+    }
+    else if (strcmp(key, "qdepth") == 0) {
+        cfg->queue_depth = atoi(val);
+    }
+    else if (strcmp(key, "array") == 0) {
+        config_set_array(cfg, val);
+    }
+    else if (strcmp(key, "profile") == 0) {
+        snprintf(cfg->profile, sizeof(cfg->profile), "%s", val);
+    }
+    else if (strcmp(key, "read_lat") == 0 || strcmp(key, "write_lat") == 0 ||
+             strcmp(key, "slow") == 0) {
+        /* 原样交给档案解析，在档案之后生效；一个值中可以有多个以';'分隔的慢区间 */
+        char   items[CONFIG_LINE_LEN], *item, *save = NULL;
+        size_t len;
+
+        snprintf(items, sizeof(items), "%s", val);
+        for (item = strtok_r(items, ";", &save); item != NULL; item = strtok_r(NULL, ";", &save)) {
+            len = strlen(cfg->profile_set);
+            snprintf(cfg->profile_set + len, sizeof(cfg->profile_set) - len, "%s = %s;", key, item);
+        }
+    }
+    else if (strcmp(key, "seed") == 0) {
+        cfg->seed = strtoull(val, NULL, 0);
+    }
+    else if (strcmp(key, "wcache") == 0) {
+        cfg->wcache_size = ddriver_parse_size(val);
+    }
+    else {
+        user_panic("unknown config key [%s]", key);
+    }
+}
+
+static char *strip(char *str) {
+    char *end;
+    while (isspace((unsigned char)*str)) {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return str;
+}
+
+static void config_load_file(struct ddriver_config *cfg, const char *path) {
+    char  line[CONFIG_LINE_LEN];
+    char *key, *val, *eq;
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL) {
+        user_panic("can't open config [%s]", path);
+        return;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        key = strip(line);
+        if (*key == '\0' || *key == '#') {
+            continue;
+        }
+        eq = strchr(key, '=');
+        if (eq == NULL) {
+            user_panic("bad config line [%s]", key);
+            continue;
+        }
+        *eq = '\0';
+        key = strip(key);
+        val = strip(eq + 1);
+        config_set(cfg, key, val);
+    }
+    fclose(fp);
+}
+
+static void config_load_env(struct ddriver_config *cfg) {
+    char  name[64];
+    char *val;
+
+    for (int i = 0; config_keys[i] != NULL; i++) {
+        int len = snprintf(name, sizeof(name), ENV_PREFIX "%s", config_keys[i]);
+        for (int j = 0; j < len; j++) {
+            name[j] = toupper((unsigned char)name[j]);
+        }
+        val = getenv(name);
+        if (val != NULL) {
+            config_set(cfg, config_keys[i], val);
+        }
+    }
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 解析大小，支持K/M/G/T后缀 (1024进制)
+ *
+ * @param val
+ * @return uint64_t 字节数
+ */
+uint64_t ddriver_parse_size(const char *val) {
+    char    *end;
+    uint64_t size = strtoull(val, &end, 0);
+
+    switch (toupper((unsigned char)*end))
+    {
+    case 'T': size <<= 10;                            /* fall through */
+    case 'G': size <<= 10;                            /* fall through */
+    case 'M': size <<= 10;                            /* fall through */
+    case 'K': size <<= 10;                            /* fall through */
+    default:
+        break;
+    }
+    return size;
+}
+/**
+ * @brief 读取配置：默认值 < 配置文件 < 环境变量
+ *
+ * @param cfg
+ */
+void ddriver_config_load(struct ddriver_config *cfg) {
+    char *path = getenv(ENV_CONFIG);
+
+    memset(cfg, 0, sizeof(struct ddriver_config));
+    cfg->disk_size   = CONFIG_DISK_SZ;
+    cfg->iounit_size = CONFIG_BLOCK_SZ;
+    cfg->track_num   = CONFIG_TRACK_NUM;
+    cfg->sched       = DDRIVER_SCHED_NOOP;
+    cfg->raid        = DDRIVER_RAID_NONE;
+    cfg->chunk_size  = CONFIG_CHUNK_SZ;
+    cfg->queue_depth = CONFIG_QDEPTH;
+
+    if (path != NULL) {
+        config_load_file(cfg, path);
+    }
+    config_load_env(cfg);
+}
+/**
+ * @brief 检查设备几何参数是否合法
+ *
+ * @param cfg
+ * @return int 0合法，否则返回负的错误号
+ */
+int ddriver_config_check(const struct ddriver_config *cfg) {
+    uint32_t io = cfg->iounit_size;
+
+    if (io < CONFIG_BLOCK_SZ || io > CONFIG_IOUNIT_MAX || (io & (io - 1)) != 0) {
+        user_panic("io size %u should be a power of 2 in [%d, %d]",
+                   io, CONFIG_BLOCK_SZ, CONFIG_IOUNIT_MAX);
+        return -EINVAL;
+    }
+    if (cfg->disk_size == 0 || cfg->disk_size % io != 0) {
+        user_panic("disk size %lu should be a multiple of io size %u",
+                   (unsigned long)cfg->disk_size, io);
+        return -EINVAL;
+    }
+    if (cfg->track_num == 0 || cfg->track_num > cfg->disk_size / io) {
+        user_panic("track num %u out of range", cfg->track_num);
+        return -EINVAL;
+    }
+    if ((cfg->flags & DDRIVER_OPEN_MMAP) && (cfg->flags & DDRIVER_OPEN_DIRECT)) {
+        user_panic("mmap and direct I/O can't be used together");
+        return -EINVAL;
+    }
+    if (cfg->nr_queues < 0 || cfg->nr_queues > DDRIVER_QUEUE_MAX ||
+        cfg->queue_depth < 1 || cfg->queue_depth > CONFIG_QDEPTH_MAX) {
+        user_panic("queues should be in [0, %d], queue depth in [1, %d]",
+                   DDRIVER_QUEUE_MAX, CONFIG_QDEPTH_MAX);
+        return -EINVAL;
+    }
+    if (cfg->raid == DDRIVER_RAID_NONE) {
+        return 0;
+    }
+    if (cfg->nr_queues != 0) {
+        user_panic("hardware queues can't be used with an array");
+        return -EINVAL;
+    }
+    if (cfg->nr_members < 2 || cfg->nr_members > DDRIVER_ARRAY_MAX) {
+        user_panic("array needs 2 to %d members", DDRIVER_ARRAY_MAX);
+        return -EINVAL;
+    }
+    if (cfg->flags & DDRIVER_OPEN_MMAP) {
+        user_panic("mmap can't be used with an array");
+        return -EINVAL;
+    }
+    if (cfg->raid == DDRIVER_RAID_STRIPE &&
+        (cfg->chunk_size == 0 || cfg->chunk_size % io != 0 ||
+         cfg->disk_size % (cfg->chunk_size * cfg->nr_members) != 0)) {
+        user_panic("disk size %lu should be a multiple of %d chunks of %lu bytes, "
+                   "chunk size a multiple of io size %u",
+                   (unsigned long)cfg->disk_size, cfg->nr_members,
+                   (unsigned long)cfg->chunk_size, io);
+        return -EINVAL;
+    }
+    return 0;
+}
@@ -0,0 +1,266 @@
+#ifndef _DDRIVER_CORE_H_
+#define _DDRIVER_CORE_H_
+
+#include "stdio.h"
+#include <sys/types.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "ddriver_ctl.h"
+
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/   
+#define USER_INFO     "INFO: "
+#define USER_ALERT    "WARNING: "
+#define USER_PANIC    "PANIC: "
+
+#define DEVICE_NAME   "ddriver"
+#define DEVICE_LOG_SUFFIX "_log"                     /* 日志文件为 <设备路径>_log */
+
+#define user_info(fmt, ...)\
+	do {\
+		printf(USER_INFO DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
+        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
+	} while(0)\
+
+#define user_alert(fmt, ...)\
+	do {\
+		printf(USER_ALERT DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
+        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
+	} while(0)\
+
+#define user_panic(fmt, ...)\
+    do {\
+        printf(USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
+    } while (0)\
+
+#define CONFIG_DISK_SZ  (4 * 1024 * 1024)            /* 默认设备大小，可在打开时配置 */
+#define CONFIG_BLOCK_SZ (512)                        /* 默认及最小IO单位 */
+#define CONFIG_TRACK_NUM (100)
+#define CONFIG_CHUNK_SZ (64 * 1024)                  /* 默认条带块大小 */
+#define CONFIG_MAX_TRANSFER (1 << 30)                /* 单次请求最大字节数，传输量以int返回 */
+
+#define DDRIVER_ARRAY_MAX   8                        /* 阵列最多成员数 */
+#define DDRIVER_RAID_NONE   0                        /* 单个后端文件 */
+#define DDRIVER_RAID_STRIPE 1                        /* 条带化 (RAID0) */
+#define DDRIVER_RAID_MIRROR 2                        /* 镜像 (RAID1) */
+#define DDRIVER_MIRROR_ANY  (-1)                     /* 镜像读的成员未选定，由阵列当场选择 */
+#define CONFIG_QDEPTH   (32)                         /* 默认硬件队列深度 */
+#define CONFIG_QDEPTH_MAX (1024)
+#ifndef IOV_MAX
+#define IOV_MAX         (1024)                       /* Same as Linux UIO_MAXIOV */
+#endif
+/******************************************************************************
+* SECTION: Macro Functions 
+*******************************************************************************/
+#define IGNORE_ARG(arg)         ((void)arg)
+#define IS_ADDR_ALIGN(addr)     ((addr) % disk.iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     (((addr) / disk.iounit_size) * disk.iounit_size)
+
+#define INC_READCNT(disk)       (atomic_fetch_add_explicit(&disk.read_cnt, 1, memory_order_relaxed))
+#define INC_WRITECNT(disk)      (atomic_fetch_add_explicit(&disk.write_cnt, 1, memory_order_relaxed))
+#define INC_SEEKCNT(disk)       (atomic_fetch_add_explicit(&disk.seek_cnt, 1, memory_order_relaxed))
+
+#define RW_LAT(disk, rw_ops, units)                                     \
+                                (ddriver_profile_##rw_ops##_lat() + (long)(units) * disk.xfer_ns / 1000)
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+/* 请求开销的分布，三者相等时为固定延迟 (us) */
+struct ddriver_lat_dist
+{
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t p999;
+};
+
+/* 与struct ddriver_stats对应的原子计数 */
+struct ddriver_counters
+{
+    _Atomic uint64_t bytes_read;
+    _Atomic uint64_t bytes_written;
+    _Atomic uint64_t seq_accesses;
+    _Atomic uint64_t rand_accesses;
+    _Atomic uint64_t seek_distance;
+    _Atomic uint64_t lat_total_us;
+    _Atomic uint64_t lat_max_us;
+    _Atomic uint64_t lat_hist[DDRIVER_LAT_BUCKETS];
+    _Atomic uint64_t region_reads[DDRIVER_REGION_MAX];
+    _Atomic uint64_t region_writes[DDRIVER_REGION_MAX];
+    _Atomic uint64_t region_bytes_read[DDRIVER_REGION_MAX];
+    _Atomic uint64_t region_bytes_written[DDRIVER_REGION_MAX];
+    _Atomic off_t    last_end;                       /* 上一请求的结束位置 */
+};
+
+struct ddriver
+{
+    int  ddriver_fd;                                 /* 设备自身持有的fd，所有读写经由它 */
+    char path[PATH_MAX];                             /* 设备镜像的绝对路径 */
+    atomic_int read_cnt;
+    atomic_int write_cnt;
+    atomic_int seek_cnt;
+    struct ddriver_lat_dist read_lat;                /* 以下延迟单位均为us，由设备档案设置 */
+    struct ddriver_lat_dist write_lat;
+    int  seek_lat;                                   /* 相邻磁道寻道 */
+    int  stroke_lat;                                 /* 全行程寻道 */
+    int  rot_lat;                                    /* 旋转一周，0为无机械部件 */
+    long xfer_ns;                                    /* 每IO单位传输 (ns) */
+    int  track_num;
+    int  major_num;
+    off_t layout_size;
+    int  iounit_size;
+    _Atomic off_t head;                              /* Disk Head */
+    _Atomic uint64_t clock_us;                       /* 模拟设备时间，累计所有计入的延迟 */
+    _Atomic uint64_t batch_done;                     /* 已完成、尚未REAP的异步批次数 */
+    int   open_cnt;                                  /* 已打开的文件描述符数 */
+    struct ddriver_regions  regions;                 /* 按区间统计的磁盘布局 */
+    struct ddriver_counters stats;
+    int   flags;                                     /* DDRIVER_OPEN_* */
+    int   sched;                                     /* DDRIVER_SCHED_* */
+    char *map;                                       /* mmap模式下的磁盘映射 */
+    pthread_mutex_t lock;                            /* 保护打开与关闭 */
+};
+struct ddriver_config
+{
+    int      flags;                                  /* DDRIVER_OPEN_* */
+    int      sched;                                  /* DDRIVER_SCHED_* */
+    char     trace[PATH_MAX];                        /* 非空时记录请求轨迹到该文件 */
+    uint64_t wcache_size;                            /* 写缓存大小，0不启用 */
+    int      raid;                                   /* DDRIVER_RAID_* */
+    int      nr_members;
+    uint64_t chunk_size;                             /* 条带块大小 */
+    char     members[PATH_MAX];                      /* 逗号分隔的成员文件列表 */
+    int      nr_queues;                              /* 硬件队列数，0为单磁头模型 */
+    int      queue_depth;
+    char     profile[PATH_MAX];                      /* 内置设备档案名或档案文件 */
+    char     profile_set[PATH_MAX];                  /* 覆盖档案中的项 */
+    uint64_t seed;                                   /* 延迟抽样的随机种子 */
+    uint64_t disk_size;
+    uint32_t iounit_size;
+    uint32_t track_num;
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+extern struct ddriver disk;
+extern FILE          *debugf;
+/******************************************************************************
+* SECTION: ddriver.c
+*******************************************************************************/
+void ddriver_delay(long us);
+int  check_range(off_t offset, size_t size);
+int  check_iov(const struct iovec *iov, int iovcnt, size_t *total);
+long emulate_spindle_lat(off_t size, off_t from, off_t to);
+long emulate_position_lat(off_t from, off_t to);
+long emulate_access_lat(int is_write, off_t offset, size_t total, int mirror);
+int  ddriver_do_rw(int fd, int op, const struct iovec *iov, 
+                   int iovcnt, off_t offset);
+int  ddriver_do_discard(int fd, off_t offset, off_t size);
+int  ddriver_flush(int fd);
+ssize_t store_readv(int fd, const struct iovec *iov, int iovcnt, off_t offset, int mirror);
+ssize_t store_writev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+ssize_t store_backend_readv(const struct iovec *iov, int iovcnt, off_t offset, int mirror);
+ssize_t store_backend_writev(const struct iovec *iov, int iovcnt, off_t offset);
+int  store_zero_fd(int fd, off_t offset, off_t size);
+/******************************************************************************
+* SECTION: ddriver_config.c
+*******************************************************************************/
+uint64_t ddriver_parse_size(const char *val);
+void ddriver_config_load(struct ddriver_config *cfg);
+int  ddriver_config_check(const struct ddriver_config *cfg);
+/******************************************************************************
+* SECTION: ddriver_stats.c
+*******************************************************************************/
+void ddriver_stats_seek(off_t from, off_t to);
+void ddriver_stats_account(int is_write, off_t offset, size_t size, long lat);
+void ddriver_stats_fill(struct ddriver_stats *stats);
+void ddriver_stats_reset(void);
+int  ddriver_stats_set_regions(const struct ddriver_regions *regions);
+/******************************************************************************
+* SECTION: ddriver_trace.c
+*******************************************************************************/
+int  ddriver_trace_start(const char *path);
+void ddriver_trace_record(int op, off_t offset, size_t size, long lat);
+void ddriver_trace_drain(void);
+void ddriver_trace_stop(void);
+/******************************************************************************
+* SECTION: ddriver_cache.c
+*******************************************************************************/
+int  ddriver_cache_init(uint64_t size);
+void ddriver_cache_destroy(void);
+int  ddriver_cache_enabled(void);
+int  ddriver_cache_absorbs(size_t size);
+int  ddriver_cache_write(const struct iovec *iov, int iovcnt, off_t offset);
+int  ddriver_cache_write_through(const struct iovec *iov, int iovcnt, off_t offset);
+int  ddriver_cache_read(const struct iovec *iov, int iovcnt, off_t offset, size_t total, 
+                        int mirror);
+int  ddriver_cache_flush(void);
+void ddriver_cache_discard(off_t offset, off_t size);
+void ddriver_cache_drop(void);
+void ddriver_cache_state(struct ddriver_cache_state *state);
+void ddriver_cache_reset(void);
+/******************************************************************************
+* SECTION: ddriver_snapshot.c
+*******************************************************************************/
+int  ddriver_overlay_load(const char *device);
+int  ddriver_overlay_active(void);
+ssize_t ddriver_overlay_readv(const struct iovec *iov, int iovcnt, off_t offset);
+ssize_t ddriver_overlay_writev(const struct iovec *iov, int iovcnt, off_t offset);
+void ddriver_overlay_mark(off_t offset, off_t size);
+int  ddriver_overlay_sync(void);
+void ddriver_overlay_close(void);
+void ddriver_overlay_drop(void);
+int  ddriver_snapshot_save(const char *path);
+int  ddriver_snapshot_restore(const char *path);
+/******************************************************************************
+* SECTION: ddriver_direct.c
+*******************************************************************************/
+int  ddriver_direct_init(const int fds[], int nr);
+void ddriver_direct_destroy(void);
+int  ddriver_direct_needs_bounce(const struct iovec *iov, int iovcnt);
+ssize_t ddriver_direct_readv(const struct iovec *iov, int iovcnt, off_t offset, int mirror);
+ssize_t ddriver_direct_writev(const struct iovec *iov, int iovcnt, off_t offset);
+/******************************************************************************
+* SECTION: ddriver_array.c
+*******************************************************************************/
+int  ddriver_array_open(const struct ddriver_config *cfg);
+void ddriver_array_close(void);
+int  ddriver_array_active(void);
+int  ddriver_array_fds(int fds[]);
+int  ddriver_array_mirror_member(int is_write, off_t offset);
+long ddriver_array_lat(int is_write, off_t offset, size_t size, int mirror);
+ssize_t ddriver_array_readv(const struct iovec *iov, int iovcnt, off_t offset, int mirror);
+ssize_t ddriver_array_writev(const struct iovec *iov, int iovcnt, off_t offset);
+int  ddriver_array_zero(off_t offset, off_t size);
+int  ddriver_array_reset(void);
+int  ddriver_array_sync(void);
+void ddriver_array_topology(struct ddriver_topology *topo);
+/******************************************************************************
+* SECTION: ddriver_queue.c
+*******************************************************************************/
+int  ddriver_queue_init(int nr, int depth);
+void ddriver_queue_destroy(void);
+int  ddriver_queue_enabled(void);
+long ddriver_queue_service(size_t size, long service);
+void ddriver_queue_advance(long us);
+void ddriver_queue_state(struct ddriver_queues *state);
+void ddriver_queue_reset(void);
+void ddriver_queue_topology(struct ddriver_topology *topo);
+/******************************************************************************
+* SECTION: ddriver_profile.c
+*******************************************************************************/
+int  ddriver_profile_load(const char *name, const char *overrides, uint64_t seed);
+long ddriver_profile_read_lat(void);
+long ddriver_profile_write_lat(void);
+long ddriver_profile_slow(off_t offset, size_t size, long lat);
+/******************************************************************************
+* SECTION: ddriver_async.c
+*******************************************************************************/
+void ddriver_async_stop(int fd);
+void ddriver_sched_state(struct ddriver_sched_state *state);
+void ddriver_sched_reset(void);
+
+#endif /* _DDRIVER_CORE_H_ */
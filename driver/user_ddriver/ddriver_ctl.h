@@ -2,11 +2,12 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <sys/types.h>
+#include <stdint.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
 #define IOC_MAGIC               'A'
-
 struct ddriver_state
 {
     int write_cnt;
@@ -14,8 +15,248 @@ struct ddriver_state
     int seek_cnt;
 };
 
+struct ddriver_geometry
+{
+    uint64_t disk_size;
+    uint32_t iounit_size;
+    uint32_t track_num;
+};
+
+struct ddriver_range
+{
+    uint64_t offset;
+    uint64_t length;
+};
+
+#define DDRIVER_SNAPSHOT_PATH_LEN 1024
+
+struct ddriver_snapshot
+{
+    char path[DDRIVER_SNAPSHOT_PATH_LEN];
+};
+
+#define DDRIVER_TOPO_DISCARD    0x1
+#define DDRIVER_TOPO_FLUSH      0x2
+#define DDRIVER_TOPO_WCACHE     0x4
+#define DDRIVER_TOPO_ROTATIONAL 0x8
+
+struct ddriver_topology
+{
+    uint64_t disk_size;
+    uint32_t min_io_size;
+    uint32_t optimal_io_size;
+    uint32_t alignment;
+    uint32_t max_transfer;
+    uint32_t nr_queues;
+    uint32_t queue_depth;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_GEOMETRY _IOR(IOC_MAGIC, 4, struct ddriver_geometry)
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 5, uint64_t)
+#define IOC_REQ_DEVICE_CLOCK    _IOR(IOC_MAGIC, 6, uint64_t)
+#define IOC_REQ_DEVICE_SCHED    _IOR(IOC_MAGIC, 7, struct ddriver_sched_state)
+#define IOC_REQ_DEVICE_STATS    _IOR(IOC_MAGIC, 8, struct ddriver_stats)
+#define IOC_REQ_DEVICE_STATS_RESET _IO(IOC_MAGIC, 9)
+#define IOC_REQ_DEVICE_REGIONS  _IOW(IOC_MAGIC, 10, struct ddriver_regions)
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 11)
+#define IOC_REQ_DEVICE_CACHE    _IOR(IOC_MAGIC, 12, struct ddriver_cache_state)
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 13, struct ddriver_range)
+#define IOC_REQ_DEVICE_SNAPSHOT _IOW(IOC_MAGIC, 14, struct ddriver_snapshot)
+#define IOC_REQ_DEVICE_RESTORE  _IOW(IOC_MAGIC, 15, struct ddriver_snapshot)
+#define IOC_REQ_DEVICE_QUEUES   _IOR(IOC_MAGIC, 16, struct ddriver_queues)
+#define IOC_REQ_DEVICE_TOPOLOGY _IOR(IOC_MAGIC, 17, struct ddriver_topology)
+#define IOC_REQ_DEVICE_BATCH    _IOWR(IOC_MAGIC, 18, struct ddriver_batch)
+#define IOC_REQ_DEVICE_REAP     _IOR(IOC_MAGIC, 19, uint64_t)
+/******************************************************************************
+* SECTION: Open flags
+*******************************************************************************/
+#define DDRIVER_OPEN_MMAP       0x1
+#define DDRIVER_OPEN_NODELAY    0x2
+#define DDRIVER_OPEN_SIMCLOCK   0x4
+#define DDRIVER_OPEN_PREALLOC   0x8
+#define DDRIVER_OPEN_DIRECT     0x10
+/******************************************************************************
+* SECTION: Async request
+*******************************************************************************/
+#define DDRIVER_OP_READ         0
+#define DDRIVER_OP_WRITE        1
+#define DDRIVER_OP_WRITE_FUA    2
+#define DDRIVER_OP_DISCARD      3
+#define DDRIVER_OP_DESTAGE      4
+#define DDRIVER_ASYNC_DEPTH     256
+
+struct ddriver_req
+{
+    int     op;
+    char   *buf;
+    size_t  size;
+    off_t   offset;
+    int     res;
+    void   *user_data;
+};
+
+/******************************************************************************
+* SECTION: Request scheduler
+*******************************************************************************/
+#define DDRIVER_SCHED_NOOP      0
+#define DDRIVER_SCHED_ELEVATOR  1
+#define DDRIVER_SCHED_DEADLINE  2
+
+struct ddriver_sched_state
+{
+    int      policy;
+    uint64_t submitted;
+    uint64_t dispatched;
+    uint64_t merged;
+    uint64_t expired;
+    uint64_t fifo_pos_us;
+    uint64_t sched_pos_us;
+};
+
+/******************************************************************************
+* SECTION: Statistics
+*******************************************************************************/
+#define DDRIVER_STATS_VERSION   1
+#define DDRIVER_LAT_BUCKETS     20
+#define DDRIVER_REGION_MAX      8
+#define DDRIVER_REGION_NAME_LEN 16
+
+struct ddriver_region
+{
+    uint64_t start;
+    uint64_t end;
+    char     name[DDRIVER_REGION_NAME_LEN];
+};
+
+struct ddriver_regions
+{
+    uint32_t nr;
+    struct ddriver_region region[DDRIVER_REGION_MAX];
+};
+
+struct ddriver_region_stats
+{
+    struct ddriver_region region;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+};
+
+struct ddriver_stats
+{
+    uint32_t version;
+    uint32_t size;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t seeks;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t seq_accesses;
+    uint64_t rand_accesses;
+    uint64_t seek_distance;
+    uint64_t lat_total_us;
+    uint64_t lat_max_us;
+    uint64_t lat_hist[DDRIVER_LAT_BUCKETS];
+    uint32_t nr_regions;
+    uint32_t reserved;
+    struct ddriver_region_stats region[DDRIVER_REGION_MAX];
+};
+
+/******************************************************************************
+* SECTION: Trace
+*******************************************************************************/
+#define DDRIVER_TRACE_MAGIC     0x43525444
+#define DDRIVER_TRACE_VERSION   1
+
+struct ddriver_trace_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t iounit_size;
+    uint32_t track_num;
+    uint64_t disk_size;
+};
+
+struct ddriver_trace_rec
+{
+    uint64_t ts_ns;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t lat_us;
+    uint16_t op;
+    uint16_t tag;
+    uint32_t reserved;
+};
+
+/******************************************************************************
+* SECTION: Write cache
+*******************************************************************************/
+#define DDRIVER_WRITE_FUA       0x1
+
+struct ddriver_cache_state
+{
+    uint64_t size;
+    uint64_t dirty;
+    uint64_t write_hits;
+    uint64_t read_hits;
+    uint64_t destages;
+    uint64_t destaged_bytes;
+    uint64_t flushes;
+};
+
+/******************************************************************************
+* SECTION: Hardware queues
+*******************************************************************************/
+#define DDRIVER_QUEUE_MAX       32
+
+struct ddriver_queue_stats
+{
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t busy_us;
+    uint64_t wait_us;
+    uint64_t lat_max_us;
+    uint64_t full;
+    uint64_t occupancy_sum;
+    uint64_t max_occupancy;
+};
+
+struct ddriver_queues
+{
+    uint32_t nr_queues;
+    uint32_t depth;
+    struct ddriver_queue_stats queue[DDRIVER_QUEUE_MAX];
+};
+
+/******************************************************************************
+* SECTION: Batched requests
+*******************************************************************************/
+#define DDRIVER_BATCH_MAX       256
+#define DDRIVER_BATCH_ASYNC     0x1
+
+struct ddriver_iodesc
+{
+    uint32_t op;
+    int32_t  res;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t buf;
+};
+
+struct ddriver_batch
+{
+    uint32_t nr;
+    uint32_t flags;
+    int32_t  eventfd;
+    uint32_t reserved;
+    uint64_t descs;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "string.h"
+#include "errno.h"
+#include "ddriver_core.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define DIRECT_POOL_NR          8                        /* 中转缓冲区个数，即可同时中转的请求数 */
+#define DIRECT_BUF_SZ           (256 * 1024)             /* 单个中转缓冲区大小 */
+#define DIRECT_ALIGN_DEFAULT    4096                     /* 无法查询宿主对齐要求时的保守取值 */
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+/**
+ * O_DIRECT要求缓冲区地址、长度与文件偏移都按宿主要求对齐。设备偏移与长度
+ * 总是IO单位的整数倍，打开时确认IO单位满足对齐即可；调用者的缓冲区则是
+ * 任意的，不对齐时借用池中预先对齐的缓冲区中转，对齐时直接下发
+ */
+struct ddriver_direct
+{
+    int              enabled;
+    uint32_t         mem_align;                       /* 缓冲区地址的对齐要求 */
+    uint32_t         off_align;                       /* 文件偏移与每段长度的对齐要求 */
+    size_t           buf_size;
+    char            *pool;                            /* DIRECT_POOL_NR个连续的缓冲区 */
+    int              free[DIRECT_POOL_NR];
+    int              nr_free;
+    pthread_mutex_t  lock;
+    pthread_cond_t   wait;                            /* 等待空闲缓冲区 */
+    _Atomic uint64_t bounced;                         /* 经中转的字节数 */
+    _Atomic uint64_t passthrough;                     /* 直接下发的字节数 */
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static struct ddriver_direct direct = {
+    .enabled = 0,
+    .pool    = NULL,
+    .lock    = PTHREAD_MUTEX_INITIALIZER,
+    .wait    = PTHREAD_COND_INITIALIZER
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+/* 取各后端文件对齐要求中最严格的 */
+static void direct_query_align(const int fds[], int nr) {
+    uint32_t mem = 0, off = 0;
+
+    for (int i = 0; i < nr; i++) {
+        uint32_t fmem = DIRECT_ALIGN_DEFAULT, foff = DIRECT_ALIGN_DEFAULT;
+#ifdef STATX_DIOALIGN
+        struct statx st;
+        if (statx(fds[i], "", AT_EMPTY_PATH, STATX_DIOALIGN, &st) == 0 &&
+            (st.stx_mask & STATX_DIOALIGN) && st.stx_dio_offset_align != 0) {
+            fmem = st.stx_dio_mem_align;
+            foff = st.stx_dio_offset_align;
+        }
+#endif
+        mem = fmem > mem ? fmem : mem;
+        off = foff > off ? foff : off;
+    }
+    direct.mem_align = mem;
+    direct.off_align = off;
+}
+
+static void direct_clear(const int fds[], int nr) {
+    for (int i = 0; i < nr; i++) {
+        int flags = fcntl(fds[i], F_GETFL);
+        if (flags >= 0)
+            fcntl(fds[i], F_SETFL, flags & ~O_DIRECT);
+    }
+}
+
+static char *direct_get(void) {
+    char *buf;
+
+    pthread_mutex_lock(&direct.lock);
+    while (direct.nr_free == 0) {
+        pthread_cond_wait(&direct.wait, &direct.lock);
+    }
+    buf = direct.pool + (size_t)direct.free[--direct.nr_free] * direct.buf_size;
+    pthread_mutex_unlock(&direct.lock);
+    return buf;
+}
+
+static void direct_put(char *buf) {
+    pthread_mutex_lock(&direct.lock);
+    direct.free[direct.nr_free++] = (int)((buf - direct.pool) / direct.buf_size);
+    pthread_cond_signal(&direct.wait);
+    pthread_mutex_unlock(&direct.lock);
+}
+
+/* 在iov的第skip字节起与buf之间拷贝n字节，to_iov决定方向 */
+static void direct_copy(const struct iovec *iov, int iovcnt, size_t skip,
+                        char *buf, size_t n, int to_iov) {
+    int i = 0;
+
+    while (i < iovcnt && skip >= iov[i].iov_len) {
+        skip -= iov[i++].iov_len;
+    }
+    while (n > 0 && i < iovcnt) {
+        size_t len = iov[i].iov_len - skip;
+        char  *p   = (char *)iov[i].iov_base + skip;
+        if (len > n)
+            len = n;
+        if (to_iov)
+            memcpy(p, buf, len);
+        else
+            memcpy(buf, p, len);
+        buf  += len;
+        n    -= len;
+        skip  = 0;
+        i++;
+    }
+}
+
+/* 中转缓冲区已对齐，直接交给store_backend_*，避免再次判断中转并计入直接下发；
+   分段读都由请求选定的同一镜像成员服务 */
+static ssize_t direct_bounce(const struct iovec *iov, int iovcnt, off_t offset,
+                             size_t total, int is_write, int mirror) {
+    char   *buf = direct_get();
+    size_t  done = 0;
+
+    while (done < total) {
+        size_t       n   = total - done < direct.buf_size ? total - done : direct.buf_size;
+        struct iovec one = { .iov_base = buf, .iov_len = n };
+        ssize_t      ret;
+
+        if (is_write) {
+            direct_copy(iov, iovcnt, done, buf, n, 0);
+            ret = store_backend_writev(&one, 1, offset + done);
+        }
+        else {
+            ret = store_backend_readv(&one, 1, offset + done, mirror);
+            if (ret > 0)
+                direct_copy(iov, iovcnt, done, buf, ret, 1);
+        }
+        if (ret <= 0) {
+            break;
+        }
+        done += ret;
+        if ((size_t)ret < n) {
+            break;
+        }
+    }
+    direct_put(buf);
+    atomic_fetch_add_explicit(&direct.bounced, done, memory_order_relaxed);
+    return done > 0 ? (ssize_t)done : -1;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 以O_DIRECT访问后端文件，由ddriver_open在配置了direct时调用
+ *
+ * 宿主文件系统不支持O_DIRECT，或IO单位不满足其对齐要求时返回错误，
+ * 由调用者退回普通读写
+ *
+ * @param fds 后端文件，组成阵列时为各成员文件
+ * @param nr
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_direct_init(const int fds[], int nr) {
+    size_t align;
+    int    flags;
+
+    direct_query_align(fds, nr);
+    if (disk.iounit_size % direct.off_align != 0 ||
+        disk.iounit_size % direct.mem_align != 0) {
+        user_alert("direct I/O needs io size aligned to %u", direct.off_align);
+        return -EINVAL;
+    }
+    direct.buf_size = DIRECT_BUF_SZ < disk.iounit_size ? disk.iounit_size : DIRECT_BUF_SZ;
+    align = direct.mem_align > (uint32_t)getpagesize() ? direct.mem_align : getpagesize();
+    if (posix_memalign((void **)&direct.pool, align, direct.buf_size * DIRECT_POOL_NR) != 0) {
+        direct.pool = NULL;
+        return -ENOMEM;
+    }
+    /* 丢掉普通读写留在宿主页缓存中的数据，之后的读写都落到存储上 */
+    for (int i = 0; i < nr; i++) {
+        fsync(fds[i]);
+        posix_fadvise(fds[i], 0, 0, POSIX_FADV_DONTNEED);
+        flags = fcntl(fds[i], F_GETFL);
+        if (flags < 0 || fcntl(fds[i], F_SETFL, flags | O_DIRECT) < 0) {
+            user_alert("host filesystem doesn't support direct I/O: %s", strerror(errno));
+            direct_clear(fds, i);
+            free(direct.pool);
+            direct.pool = NULL;
+            return -EINVAL;
+        }
+    }
+    for (direct.nr_free = 0; direct.nr_free < DIRECT_POOL_NR; direct.nr_free++) {
+        direct.free[direct.nr_free] = direct.nr_free;
+    }
+    atomic_store(&direct.bounced, 0);
+    atomic_store(&direct.passthrough, 0);
+    direct.enabled = 1;
+    return 0;
+}
+/**
+ * @brief 释放中转缓冲区，由最后一次ddriver_close调用
+ */
+void ddriver_direct_destroy(void) {
+    if (!direct.enabled) {
+        return;
+    }
+    user_info("direct I/O: %lu bytes passed through, %lu bytes bounced",
+              atomic_load(&direct.passthrough), atomic_load(&direct.bounced));
+    direct.enabled = 0;
+    free(direct.pool);
+    direct.pool = NULL;
+}
+/**
+ * @brief 判断请求是否需要经中转缓冲区，不需要时计入直接下发的字节数
+ *
+ * @param iov
+ * @param iovcnt
+ * @return int 1需要中转
+ */
+int ddriver_direct_needs_bounce(const struct iovec *iov, int iovcnt) {
+    size_t   total = 0;
+    uint32_t len_align;
+
+    if (!direct.enabled) {
+        return 0;
+    }
+    /* O_DIRECT要求每段长度同时是逻辑块大小的整数倍，不只是内存对齐 */
+    len_align = direct.off_align > direct.mem_align ? direct.off_align : direct.mem_align;
+    for (int i = 0; i < iovcnt; i++) {
+        if ((uintptr_t)iov[i].iov_base % direct.mem_align != 0 ||
+            iov[i].iov_len % len_align != 0) {
+            return 1;
+        }
+        total += iov[i].iov_len;
+    }
+    atomic_fetch_add_explicit(&direct.passthrough, total, memory_order_relaxed);
+    return 0;
+}
+/**
+ * @brief 经对齐的中转缓冲区读，超过缓冲区大小时分段进行
+ *
+ * @param iov 调用者的缓冲区，不要求对齐
+ * @param iovcnt
+ * @param offset
+ * @param mirror 读数据的镜像成员
+ * @return ssize_t 读出的字节数，失败返回-1
+ */
+ssize_t ddriver_direct_readv(const struct iovec *iov, int iovcnt, off_t offset, int mirror) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    return direct_bounce(iov, iovcnt, offset, total, 0, mirror);
+}
+/**
+ * @brief 经对齐的中转缓冲区写，超过缓冲区大小时分段进行
+ *
+ * @param iov 调用者的缓冲区，不要求对齐
+ * @param iovcnt
+ * @param offset
+ * @return ssize_t 写入的字节数，失败返回-1
+ */
+ssize_t ddriver_direct_writev(const struct iovec *iov, int iovcnt, off_t offset) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    return direct_bounce(iov, iovcnt, offset, total, 1, DDRIVER_MIRROR_ANY);
+}
@@ -0,0 +1,365 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include "string.h"
+#include <ctype.h>
+#include "errno.h"
+#include "ddriver_core.h"
+#include "ddriver_profiles.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define PROFILE_SLOW_MAX        8                        /* 最多慢区间数 */
+#define PROFILE_STEPS           16                       /* 每段分位区间的插值点数 */
+#define PROFILE_TEXT_MAX        4096
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+/**
+ * 延迟分布由p50/p99/p999确定，分位函数分四段，段内对数线性插值：
+ *   [0, 0.5)      p50/2 -> p50
+ *   [0.5, 0.99)   p50   -> p99
+ *   [0.99, 0.999) p99   -> p999
+ *   [0.999, 1)    p999  -> p999 * p999 / p99，按最后一段的斜率外推
+ * 三者相等时为固定延迟，不消耗随机数，结果与旧版本完全一致
+ */
+struct lat_table
+{
+    int    fixed;
+    double point[4][PROFILE_STEPS + 1];
+};
+
+struct slow_region
+{
+    off_t start;
+    off_t end;
+    int   factor;                                     /* 落在区间内的访问延迟乘以该倍数 */
+};
+
+struct ddriver_profile
+{
+    char               name[64];
+    uint64_t           bandwidth;                     /* 介质传输率 (字节/秒) */
+    struct lat_table   read;
+    struct lat_table   write;
+    int                nr_slow;
+    struct slow_region slow[PROFILE_SLOW_MAX];
+    uint64_t           seed;
+    uint32_t           gen;                           /* 每次加载加一，使线程重新播种 */
+    _Atomic uint64_t   streams;
+};
+
+/**
+ * 内置设备档案见ddriver_profiles.h。档案文件与DDRIVER_PROFILE使用同样的格式：每行或每个';'
+ * 分隔一项 key = value，#开头为注释；内核驱动的profile参数也使用该格式
+ */
+struct builtin_profile
+{
+    const char *name;
+    const char *spec;
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static const struct builtin_profile builtins[] = {
+    /* default为旧版本的固定延迟模型；hdd的尾部来自重读与重新校准，sata-ssd的写尾部来自
+       垃圾回收，sdcard写入时擦除整块导致长尾 */
+    DDRIVER_BUILTIN_PROFILES
+};
+
+static struct ddriver_profile prof = {
+    .name = "default",
+    .gen  = 0
+};
+
+static __thread uint64_t rng_state;
+static __thread uint32_t rng_gen = 0;
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x  = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x  = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* [0, 1)均匀分布，各线程独立的xorshift64*序列，由种子与线程序号决定 */
+static double profile_uniform(void) {
+    if (rng_gen != prof.gen) {
+        rng_gen   = prof.gen;
+        rng_state = splitmix64(prof.seed + atomic_fetch_add(&prof.streams, 1)) | 1;
+    }
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* 不依赖libm的平方根，牛顿迭代 */
+static double profile_sqrt(double x) {
+    double r = x > 1 ? x : 1;
+    for (int i = 0; i < 64; i++) {
+        r = (r + x / r) / 2;
+    }
+    return r;
+}
+
+/* 在[a, b]间取PROFILE_STEPS + 1个等比点，公比为 (b/a) 的16次方根 */
+static void profile_segment(double *point, double a, double b) {
+    double ratio = b / a;
+    for (int i = 0; i < 4; i++) {
+        ratio = profile_sqrt(ratio);
+    }
+    point[0] = a;
+    for (int i = 1; i <= PROFILE_STEPS; i++) {
+        point[i] = point[i - 1] * ratio;
+    }
+    point[PROFILE_STEPS] = b;
+}
+
+static void profile_build(struct lat_table *t, const struct ddriver_lat_dist *d) {
+    double p50 = d->p50 ? d->p50 : 1, p99 = d->p99, p999 = d->p999;
+
+    t->fixed = d->p99 == d->p50 && d->p999 == d->p50;
+    if (t->fixed) {
+        return;
+    }
+    profile_segment(t->point[0], p50 / 2, p50);
+    profile_segment(t->point[1], p50, p99);
+    profile_segment(t->point[2], p99, p999);
+    profile_segment(t->point[3], p999, p999 * p999 / p99);
+}
+
+static long profile_sample(const struct lat_table *t, const struct ddriver_lat_dist *d) {
+    static const double bound[5] = { 0, 0.5, 0.99, 0.999, 1 };
+    double u, f;
+    int    seg, i;
+
+    if (t->fixed) {
+        return d->p50;
+    }
+    u = profile_uniform();
+    for (seg = 0; seg < 3 && u >= bound[seg + 1]; seg++) {
+        ;
+    }
+    f  = (u - bound[seg]) / (bound[seg + 1] - bound[seg]) * PROFILE_STEPS;
+    i  = (int)f;
+    f -= i;
+    if (i >= PROFILE_STEPS) {
+        return (long)t->point[seg][PROFILE_STEPS];
+    }
+    return (long)(t->point[seg][i] + (t->point[seg][i + 1] - t->point[seg][i]) * f);
+}
+
+static int profile_parse_dist(struct ddriver_lat_dist *d, const char *val) {
+    char    *end;
+    uint32_t p[3];
+    int      nr = 0;
+
+    while (nr < 3) {
+        while (*val == ' ' || *val == ',' || *val == '\t')
+            val++;
+        if (*val == '\0')
+            break;
+        p[nr++] = (uint32_t)strtoul(val, &end, 0);
+        if (end == val)
+            return -EINVAL;
+        val = end;
+    }
+    if (nr == 0)
+        return -EINVAL;
+    d->p50  = p[0];
+    d->p99  = nr > 1 ? p[1] : d->p50;
+    d->p999 = nr > 2 ? p[2] : d->p99;
+    return d->p50 <= d->p99 && d->p99 <= d->p999 ? 0 : -EINVAL;
+}
+
+static int profile_parse_slow(const char *val) {
+    char *end;
+    struct slow_region *r;
+
+    if (prof.nr_slow == PROFILE_SLOW_MAX) {
+        return -ENOSPC;
+    }
+    r        = &prof.slow[prof.nr_slow];
+    r->start = ddriver_parse_size(val);
+    val      = strpbrk(val, " :\t");
+    if (val == NULL)
+        return -EINVAL;
+    r->end   = r->start + ddriver_parse_size(val + strspn(val, " :\t"));
+    val      = strpbrk(val + strspn(val, " :\t"), " :\t");
+    if (val == NULL)
+        return -EINVAL;
+    r->factor = (int)strtol(val + strspn(val, " :\t"), &end, 0);
+    if (r->factor < 1 || r->end <= r->start)
+        return -EINVAL;
+    prof.nr_slow++;
+    return 0;
+}
+
+static int profile_set(const char *key, const char *val) {
+    if (strcmp(key, "read_lat") == 0)
+        return profile_parse_dist(&disk.read_lat, val);
+    if (strcmp(key, "write_lat") == 0)
+        return profile_parse_dist(&disk.write_lat, val);
+    if (strcmp(key, "seek_lat") == 0)
+        disk.seek_lat = atoi(val);
+    else if (strcmp(key, "stroke_lat") == 0)
+        disk.stroke_lat = atoi(val);
+    else if (strcmp(key, "rot_lat") == 0)
+        disk.rot_lat = atoi(val);
+    else if (strcmp(key, "bandwidth") == 0)
+        prof.bandwidth = ddriver_parse_size(val);
+    else if (strcmp(key, "slow") == 0)
+        return profile_parse_slow(val);
+    else
+        return -ENOENT;
+    return 0;
+}
+
+static char *profile_strip(char *str) {
+    char *end;
+    while (isspace((unsigned char)*str)) {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return str;
+}
+
+static int profile_parse(const char *spec) {
+    char  text[PROFILE_TEXT_MAX];
+    char *item, *save = NULL, *eq, *key;
+    int   ret;
+
+    snprintf(text, sizeof(text), "%s", spec);
+    for (item = strtok_r(text, ";\n", &save); item != NULL; item = strtok_r(NULL, ";\n", &save)) {
+        if ((eq = strchr(item, '#')) != NULL)
+            *eq = '\0';
+        key = profile_strip(item);
+        if (*key == '\0')
+            continue;
+        eq = strchr(key, '=');
+        if (eq == NULL) {
+            user_panic("bad profile item [%s]", key);
+            return -EINVAL;
+        }
+        *eq = '\0';
+        key = profile_strip(key);
+        ret = profile_set(key, profile_strip(eq + 1));
+        if (ret < 0) {
+            user_panic("bad profile item [%s]: %s", key, strerror(-ret));
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static int profile_read_file(const char *path, char *text, size_t size) {
+    FILE  *fp = fopen(path, "r");
+    size_t n;
+
+    if (fp == NULL) {
+        user_panic("unknown profile [%s]", path);
+        return -ENOENT;
+    }
+    n = fread(text, 1, size - 1, fp);
+    text[n] = '\0';
+    fclose(fp);
+    return 0;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 加载设备档案，由ddriver_open在设置IO单位之后调用
+ *
+ * @param name 内置档案名或档案文件路径，为空时使用default
+ * @param overrides 覆盖档案中的项，格式同档案，可为空
+ * @param seed 随机种子，相同种子的单线程运行结果可复现
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_profile_load(const char *name, const char *overrides, uint64_t seed) {
+    char        text[PROFILE_TEXT_MAX];
+    const char *spec = NULL;
+    int         ret;
+
+    if (name == NULL || *name == '\0') {
+        name = "default";
+    }
+    for (int i = 0; builtins[i].name != NULL; i++) {
+        if (strcmp(builtins[i].name, name) == 0)
+            spec = builtins[i].spec;
+    }
+    if (spec == NULL) {
+        if (profile_read_file(name, text, sizeof(text)) < 0)
+            return -ENOENT;
+        spec = text;
+    }
+
+    /* 先回到default，档案中未给出的项沿用默认值 */
+    prof.nr_slow = 0;
+    if ((ret = profile_parse(builtins[0].spec)) < 0 ||
+        (ret = profile_parse(spec)) < 0 ||
+        (overrides != NULL && (ret = profile_parse(overrides)) < 0)) {
+        return ret;
+    }
+    if (prof.bandwidth == 0) {
+        user_panic("profile [%s] needs a bandwidth", name);
+        return -EINVAL;
+    }
+    snprintf(prof.name, sizeof(prof.name), "%s", name);
+    disk.xfer_ns = disk.iounit_size * 1000000000ULL / prof.bandwidth;
+    profile_build(&prof.read, &disk.read_lat);
+    profile_build(&prof.write, &disk.write_lat);
+    prof.seed = seed;
+    atomic_store(&prof.streams, 0);
+    prof.gen++;
+
+    if (strcmp(prof.name, "default") != 0 || overrides != NULL) {
+        user_info("profile %s: read %u/%u/%u us, write %u/%u/%u us (p50/p99/p999), "
+                  "%lu MB/s, %d slow regions", prof.name,
+                  disk.read_lat.p50, disk.read_lat.p99, disk.read_lat.p999,
+                  disk.write_lat.p50, disk.write_lat.p99, disk.write_lat.p999,
+                  prof.bandwidth / 1000000, prof.nr_slow);
+    }
+    return 0;
+}
+/**
+ * @brief 按读延迟分布抽样一次请求开销
+ *
+ * @return long 延迟 (us)
+ */
+long ddriver_profile_read_lat(void) {
+    return profile_sample(&prof.read, &disk.read_lat);
+}
+/**
+ * @brief 按写延迟分布抽样一次请求开销
+ *
+ * @return long 延迟 (us)
+ */
+long ddriver_profile_write_lat(void) {
+    return profile_sample(&prof.write, &disk.write_lat);
+}
+/**
+ * @brief 访问与慢区间重叠时放大延迟，模拟需要反复重试的坏扇区或慢区域
+ *
+ * @param offset
+ * @param size
+ * @param lat 正常延迟 (us)
+ * @return long 放大后的延迟 (us)
+ */
+long ddriver_profile_slow(off_t offset, size_t size, long lat) {
+    int factor = 1;
+
+    for (int i = 0; i < prof.nr_slow; i++) {
+        if (offset < prof.slow[i].end && offset + (off_t)size > prof.slow[i].start &&
+            prof.slow[i].factor > factor) {
+            factor = prof.slow[i].factor;
+        }
+    }
+    return lat * factor;
+}
@@ -0,0 +1,28 @@
+#ifndef _DDRIVER_PROFILES_H_
+#define _DDRIVER_PROFILES_H_
+/******************************************************************************
+* SECTION: Builtin device profiles
+*******************************************************************************/
+/**
+ * 内置设备档案，与内核驱动的ddriver_profiles.h保持一致，两个后端测得的延迟可以直接比较。
+ * 每个';'分隔一项 key = value：
+ *   read_lat / write_lat   p50 [p99 [p999]]，每次请求的开销 (us)
+ *   seek_lat / stroke_lat  相邻磁道 / 全行程寻道 (us)
+ *   rot_lat                旋转一周 (us)，0为无机械部件
+ *   bandwidth              介质传输率 (字节/秒)，可带K/M/G后缀
+ *   slow                   起始 长度 倍数，落在区间内的访问延迟乘以倍数
+ */
+#define DDRIVER_BUILTIN_PROFILES                                                            \
+    { "default",  "read_lat = 200; write_lat = 100; seek_lat = 500; stroke_lat = 8000;"     \
+                  "rot_lat = 8333; bandwidth = 128000000" },                                \
+    { "hdd",      "read_lat = 200 1500 12000; write_lat = 100 1000 10000; seek_lat = 500;"  \
+                  "stroke_lat = 8000; rot_lat = 8333; bandwidth = 150M" },                  \
+    { "sata-ssd", "read_lat = 90 400 2000; write_lat = 40 1500 8000; seek_lat = 0;"         \
+                  "stroke_lat = 0; rot_lat = 0; bandwidth = 520M" },                        \
+    { "nvme",     "read_lat = 20 80 400; write_lat = 15 60 1500; seek_lat = 0;"             \
+                  "stroke_lat = 0; rot_lat = 0; bandwidth = 3000M" },                       \
+    { "sdcard",   "read_lat = 400 3000 20000; write_lat = 1500 30000 150000; seek_lat = 0;" \
+                  "stroke_lat = 0; rot_lat = 0; bandwidth = 20M" },                         \
+    { NULL, NULL }
+
+#endif
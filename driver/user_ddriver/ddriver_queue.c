@@ -0,0 +1,241 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include "string.h"
+#include "errno.h"
+#include <pthread.h>
+#include <time.h>
+#include "ddriver_core.h"
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+/**
+ * 每个硬件队列有depth个独立的服务单元，各自记录空闲的时刻。请求到达时
+ * 占用一个单元，开始时刻为 max(到达, 单元空闲)，完成延迟为
+ * 排队等待 + 服务时间：占用未满时不等待，满后延迟随占用线性增长。
+ * 各队列互不影响，设备总并行度为 队列数 x 深度
+ */
+struct hw_queue
+{
+    pthread_mutex_t            lock;
+    uint64_t                  *lane;              /* 各服务单元空闲的时刻 (us) */
+    struct ddriver_queue_stats stat;
+};
+
+struct ddriver_mq
+{
+    int              nr;
+    int              depth;
+    uint32_t         gen;                         /* 每次初始化加一，使线程重新绑定 */
+    uint64_t         start_us;
+    uint64_t         start_clock;                 /* 启用时的设备时间 */
+    _Atomic int      next;                        /* 线程绑定队列的轮转位置 */
+    struct hw_queue *queue;
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static struct ddriver_mq mq = {
+    .nr    = 0,
+    .queue = NULL
+};
+
+/* 线程像绑定CPU的提交队列一样固定使用一个硬件队列 */
+static __thread int      my_queue = -1;
+static __thread uint32_t my_gen   = 0;
+static __thread uint64_t my_now   = 0;            /* simclock模式下本线程的模拟时刻 */
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static uint64_t queue_wall_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void queue_bind(void) {
+    if (my_gen == mq.gen) {
+        return;
+    }
+    my_gen   = mq.gen;
+    my_queue = atomic_fetch_add_explicit(&mq.next, 1, memory_order_relaxed) % mq.nr;
+    my_now   = mq.start_clock;
+}
+
+/**
+ * 当前时刻：休眠模式下为打开以来的真实时间；simclock模式下各线程
+ * 视为同时开始的闭环请求者，沿自己的模拟时间线前进，只在争用同一
+ * 队列的服务单元时相互等待，设备时间取各线程的最大值
+ */
+static uint64_t queue_now(void) {
+    if (disk.flags & DDRIVER_OPEN_SIMCLOCK) {
+        return my_now;
+    }
+    return queue_wall_us() - mq.start_us;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 启用多队列模型，由ddriver_open在配置了queues时调用
+ *
+ * @param nr 硬件队列数
+ * @param depth 每个队列的深度
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_queue_init(int nr, int depth) {
+    mq.queue = calloc(nr, sizeof(struct hw_queue));
+    if (mq.queue == NULL) {
+        return -ENOMEM;
+    }
+    for (int q = 0; q < nr; q++) {
+        mq.queue[q].lane = calloc(depth, sizeof(uint64_t));
+        if (mq.queue[q].lane == NULL) {
+            mq.nr = q;
+            ddriver_queue_destroy();
+            return -ENOMEM;
+        }
+        pthread_mutex_init(&mq.queue[q].lock, NULL);
+    }
+    mq.nr       = nr;
+    mq.depth    = depth;
+    mq.start_us    = queue_wall_us();
+    mq.start_clock = atomic_load(&disk.clock_us);
+    mq.gen++;
+    atomic_store(&mq.next, 0);
+    return 0;
+}
+/**
+ * @brief 释放各队列，由最后一次ddriver_close调用
+ */
+void ddriver_queue_destroy(void) {
+    for (int q = 0; q < mq.nr; q++) {
+        pthread_mutex_destroy(&mq.queue[q].lock);
+        free(mq.queue[q].lane);
+    }
+    free(mq.queue);
+    mq.queue = NULL;
+    mq.nr    = 0;
+}
+/**
+ * @brief 是否启用了多队列模型
+ *
+ * @return int
+ */
+int ddriver_queue_enabled(void) {
+    return mq.nr > 0;
+}
+/**
+ * @brief 将请求交给本线程绑定的硬件队列服务
+ *
+ * @param size 传输的字节数
+ * @param service 服务时间 (us)，即请求开销 + 传输延迟
+ * @return long 完成延迟 (us)，含排队等待
+ */
+long ddriver_queue_service(size_t size, long service) {
+    struct hw_queue *hq;
+    uint64_t now, start, end;
+    uint32_t busy = 0;
+    int      pick = -1, first = 0;
+
+    queue_bind();
+    hq  = &mq.queue[my_queue];
+    now = queue_now();
+
+    /**
+     * 有空闲单元时取其中最晚空闲的一个，把更早空闲的单元留给时间线
+     * 落后的线程；全忙时取最早空闲的单元，等待其完成
+     */
+    pthread_mutex_lock(&hq->lock);
+    for (int i = 0; i < mq.depth; i++) {
+        if (hq->lane[i] > now)
+            busy++;
+        else if (pick < 0 || hq->lane[i] > hq->lane[pick])
+            pick = i;
+        if (hq->lane[i] < hq->lane[first])
+            first = i;
+    }
+    if (pick < 0)
+        pick = first;
+    start = hq->lane[pick] > now ? hq->lane[pick] : now;
+    end   = start + service;
+    hq->lane[pick] = end;
+
+    hq->stat.requests++;
+    hq->stat.bytes         += size;
+    hq->stat.busy_us       += service;
+    hq->stat.wait_us       += start - now;
+    hq->stat.occupancy_sum += busy;
+    if (busy == (uint32_t)mq.depth)
+        hq->stat.full++;
+    if (busy > hq->stat.max_occupancy)
+        hq->stat.max_occupancy = busy;
+    if (end - now > hq->stat.lat_max_us)
+        hq->stat.lat_max_us = end - now;
+    pthread_mutex_unlock(&hq->lock);
+    return end - now;
+}
+/**
+ * @brief 计入一段延迟：多队列模型下设备时间为各线程完成时刻的最大值，
+ *        而不是所有延迟之和，由ddriver_delay调用
+ *
+ * @param us
+ */
+void ddriver_queue_advance(long us) {
+    uint64_t end, clock;
+
+    queue_bind();
+    end = queue_now() + us;
+    if (disk.flags & DDRIVER_OPEN_SIMCLOCK) {
+        my_now = end;
+    }
+    clock = atomic_load(&disk.clock_us);
+    while (clock < end &&
+           !atomic_compare_exchange_weak(&disk.clock_us, &clock, end)) {
+        ;
+    }
+}
+/**
+ * @brief 获取各队列统计
+ *
+ * @param state
+ */
+void ddriver_queue_state(struct ddriver_queues *state) {
+    memset(state, 0, sizeof(struct ddriver_queues));
+    state->nr_queues = mq.nr;
+    state->depth     = mq.depth;
+    for (int q = 0; q < mq.nr; q++) {
+        pthread_mutex_lock(&mq.queue[q].lock);
+        state->queue[q] = mq.queue[q].stat;
+        pthread_mutex_unlock(&mq.queue[q].lock);
+    }
+}
+/**
+ * @brief 清零各队列统计，由ddriver_stats_reset调用。设备时间已随统计清零，
+ *        各队列与各线程的时间线也从此刻重新开始，否则下一次ddriver_queue_advance
+ *        又会把设备时间推回清零前的值
+ */
+void ddriver_queue_reset(void) {
+    for (int q = 0; q < mq.nr; q++) {
+        pthread_mutex_lock(&mq.queue[q].lock);
+        memset(&mq.queue[q].stat, 0, sizeof(struct ddriver_queue_stats));
+        memset(mq.queue[q].lane, 0, mq.depth * sizeof(uint64_t));
+        pthread_mutex_unlock(&mq.queue[q].lock);
+    }
+    mq.start_us    = queue_wall_us();
+    mq.start_clock = atomic_load(&disk.clock_us);
+    mq.gen++;
+}
+/**
+ * @brief 修正多队列模型的拓扑：没有机械定位代价，并行度为 队列数 x 深度
+ *
+ * @param topo
+ */
+void ddriver_queue_topology(struct ddriver_topology *topo) {
+    if (mq.nr == 0) {
+        return;
+    }
+    topo->nr_queues   = mq.nr;
+    topo->queue_depth = mq.depth;
+    topo->flags      &= ~DDRIVER_TOPO_ROTATIONAL;
+}
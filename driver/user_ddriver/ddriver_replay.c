@@ -0,0 +1,254 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include "string.h"
+#include "errno.h"
+#include <pwd.h>
+#include <limits.h>
+#include <time.h>
+#include "ddriver.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define REPLAY_BATCH        1024                         /* 一次读入的记录数 */
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static void usage(const char *prog) {
+    printf("用法: %s [options] <trace>\n", prog);
+    printf("按轨迹文件重放请求，写入的数据为0，会覆盖设备内容\n");
+    printf("options: \n");
+    printf("-d <path>       设备路径，默认$DDRIVER_DEVICE，未设置时为$HOME/ddriver\n");
+    printf("-m <mode>       延迟模式: sleep(默认) / nodelay / simclock\n");
+    printf("-s <sched>      异步调度策略: noop / elevator / deadline\n");
+    printf("-q <depth>      队列深度，大于1时经异步队列提交，默认1\n");
+    printf("-t              按记录的时间戳发起请求，默认逐个背靠背发起\n");
+    printf("-D              以O_DIRECT访问后端文件，与默认的缓冲读写对比\n");
+    printf("-h              打印本帮助菜单\n");
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void wait_until(uint64_t start, uint64_t ts_ns) {
+    uint64_t now = now_ns() - start;
+    if (ts_ns > now) {
+        usleep((ts_ns - now) / 1000);
+    }
+}
+
+static void report(int fd, uint64_t nr, uint64_t wall_ns, int depth) {
+    struct ddriver_stats       stats;
+    struct ddriver_sched_state sched;
+    struct ddriver_cache_state cache;
+    struct ddriver_queues      queues;
+    uint64_t                   clock_us;
+
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &clock_us);
+    printf("requests:      %lu\n", nr);
+    printf("wall time:     %.3f ms\n", wall_ns / 1e6);
+    printf("device time:   %.3f ms\n", clock_us / 1e3);
+    printf("reads/writes:  %lu / %lu (%lu / %lu bytes)\n", stats.reads, stats.writes,
+           stats.bytes_read, stats.bytes_written);
+    printf("seq/rand:      %lu / %lu\n", stats.seq_accesses, stats.rand_accesses);
+    printf("seeks:         %lu, %lu bytes travelled\n", stats.seeks, stats.seek_distance);
+    printf("latency:       total %lu us, max %lu us\n", stats.lat_total_us, stats.lat_max_us);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CACHE, &cache);
+    if (cache.size != 0) {
+        printf("write cache:   %lu bytes, %lu overwrites absorbed, %lu read hits\n",
+               cache.size, cache.write_hits, cache.read_hits);
+        printf("destage:       %lu accesses, %lu bytes, %lu flushes\n",
+               cache.destages, cache.destaged_bytes, cache.flushes);
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_QUEUES, &queues);
+    for (uint32_t q = 0; q < queues.nr_queues; q++) {
+        struct ddriver_queue_stats *qs = &queues.queue[q];
+        if (qs->requests == 0)
+            continue;
+        printf("queue %-2u:      %lu requests, util %.1f%%, avg occupancy %.2f/%u, "
+               "wait %lu us, full %lu, max lat %lu us\n",
+               q, qs->requests, clock_us ? 100.0 * qs->busy_us / clock_us / queues.depth : 0.0,
+               (double)qs->occupancy_sum / qs->requests, queues.depth,
+               qs->wait_us, qs->full, qs->lat_max_us);
+    }
+    if (depth > 1) {
+        ddriver_ioctl(fd, IOC_REQ_DEVICE_SCHED, &sched);
+        printf("scheduler:     policy %d, %lu dispatched, %lu merged\n",
+               sched.policy, sched.dispatched, sched.merged);
+        printf("positioning:   %lu us (%lu us in submission order)\n",
+               sched.sched_pos_us, sched.fifo_pos_us);
+    }
+}
+/******************************************************************************
+* SECTION: Main
+*******************************************************************************/
+int main(int argc, char **argv) {
+    char                     device[PATH_MAX] = {0};
+    int                      flags = 0, direct = 0, depth = 1, timed = 0, opt, fd;
+    struct ddriver_trace_hdr hdr;
+    struct ddriver_trace_rec recs[REPLAY_BATCH];
+    struct ddriver_geometry  geo;
+    struct ddriver_req      *reqs, *done[DDRIVER_ASYNC_DEPTH];
+    char                    *buf;
+    uint64_t                 nr = 0, start;
+    int                      inflight = 0, slot, nr_free, *free_slots, failed = 0;
+    size_t                   got, max_size = 0;
+    FILE                    *fp;
+
+    if (getenv("DDRIVER_DEVICE") != NULL)
+        snprintf(device, sizeof(device), "%s", getenv("DDRIVER_DEVICE"));
+    else
+        snprintf(device, sizeof(device), "%s/ddriver", getpwuid(getuid())->pw_dir);
+    while ((opt = getopt(argc, argv, "d:m:s:q:tDh")) != -1) {
+        switch (opt)
+        {
+        case 'd':
+            snprintf(device, sizeof(device), "%s", optarg);
+            break;
+        case 'm':
+            if (strcmp(optarg, "nodelay") == 0)
+                flags = DDRIVER_OPEN_NODELAY;
+            else if (strcmp(optarg, "simclock") == 0)
+                flags = DDRIVER_OPEN_SIMCLOCK;
+            else if (strcmp(optarg, "sleep") != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            setenv("DDRIVER_SCHED", optarg, 1);
+            break;
+        case 'q':
+            depth = atoi(optarg);
+            if (depth < 1 || depth > DDRIVER_ASYNC_DEPTH) {
+                printf("depth should be in [1, %d]\n", DDRIVER_ASYNC_DEPTH);
+                return 1;
+            }
+            break;
+        case 't':
+            timed = 1;
+            break;
+        case 'D':
+            direct = DDRIVER_OPEN_DIRECT;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    fp = fopen(argv[optind], "rb");
+    if (fp == NULL) {
+        printf("can't open trace %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != DDRIVER_TRACE_MAGIC ||
+        hdr.version != DDRIVER_TRACE_VERSION) {
+        printf("%s is not a ddriver trace\n", argv[optind]);
+        fclose(fp);
+        return 1;
+    }
+
+    /* 以记录时的几何参数打开设备，轨迹中的偏移才有相同的含义 */
+    geo.disk_size   = hdr.disk_size;
+    geo.iounit_size = hdr.iounit_size;
+    geo.track_num   = hdr.track_num;
+    unsetenv("DDRIVER_TRACE");
+    fd = ddriver_open_geometry(device, flags | direct, &geo);
+    if (fd < 0) {
+        fclose(fp);
+        return 1;
+    }
+
+    /* 先扫一遍得到最大请求大小，作为每个槽位的缓冲区大小 */
+    while ((got = fread(recs, sizeof(struct ddriver_trace_rec), REPLAY_BATCH, fp)) > 0) {
+        for (size_t i = 0; i < got; i++) {
+            if (recs[i].op != DDRIVER_OP_DESTAGE && recs[i].size > max_size)
+                max_size = recs[i].size;
+        }
+    }
+    fseek(fp, sizeof(hdr), SEEK_SET);
+
+    buf        = calloc(depth, max_size ? max_size : 1);
+    reqs       = calloc(depth, sizeof(struct ddriver_req));
+    free_slots = calloc(depth, sizeof(int));
+    if (buf == NULL || reqs == NULL || free_slots == NULL) {
+        printf("no memory\n");
+        return 1;
+    }
+    for (nr_free = 0; nr_free < depth; nr_free++) {
+        free_slots[nr_free] = nr_free;
+    }
+
+    start = now_ns();
+    while (!failed && (got = fread(recs, sizeof(struct ddriver_trace_rec), REPLAY_BATCH, fp)) > 0) {
+        for (size_t i = 0; i < got; i++) {
+            struct ddriver_trace_rec *rec = &recs[i];
+            char *data;
+
+            /* 写回由回放时的写缓存重新产生 */
+            if (rec->op == DDRIVER_OP_DESTAGE) {
+                continue;
+            }
+            if (timed) {
+                wait_until(start, rec->ts_ns);
+            }
+            if (depth == 1) {
+                struct iovec iov = { .iov_base = buf, .iov_len = rec->size };
+                struct ddriver_range range = { .offset = rec->offset, .length = rec->size };
+                if (rec->op == DDRIVER_OP_READ)
+                    ddriver_readv(fd, &iov, 1, rec->offset);
+                else if (rec->op == DDRIVER_OP_DISCARD)
+                    ddriver_ioctl(fd, IOC_REQ_DEVICE_DISCARD, &range);
+                else
+                    ddriver_writev_flags(fd, &iov, 1, rec->offset, 
+                                         rec->op == DDRIVER_OP_WRITE_FUA ? DDRIVER_WRITE_FUA : 0);
+                nr++;
+                continue;
+            }
+
+            /* 队列已满时至少收割一个，回收其槽位 */
+            if (nr_free == 0) {
+                int n = ddriver_async_wait(fd, done, 1, DDRIVER_ASYNC_DEPTH);
+                for (int k = 0; k < n; k++) {
+                    free_slots[nr_free++] = (int)(done[k] - reqs);
+                }
+                inflight -= n;
+            }
+            slot = free_slots[--nr_free];
+            data = buf + (size_t)slot * max_size;
+            reqs[slot].op     = rec->op;
+            reqs[slot].buf    = data;
+            reqs[slot].size   = rec->size;
+            reqs[slot].offset = rec->offset;
+            if (ddriver_async_submit(fd, &reqs[slot], 1) != 1) {
+                printf("submit failed at record %lu\n", nr);
+                free_slots[nr_free++] = slot;
+                failed = 1;
+                break;
+            }
+            inflight++;
+            nr++;
+        }
+    }
+    while (inflight > 0) {
+        inflight -= ddriver_async_wait(fd, done, inflight, DDRIVER_ASYNC_DEPTH);
+    }
+
+    ddriver_flush(fd);                                /* 写回缓存，计入写回代价 */
+    report(fd, nr, now_ns() - start, depth);
+    ddriver_close(fd);
+    fclose(fp);
+    free(buf);
+    free(reqs);
+    free(free_slots);
+    return failed;
+}
@@ -0,0 +1,429 @@
+#define _GNU_SOURCE
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include "string.h"
+#include "errno.h"
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include "ddriver_core.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define COW_SUFFIX              ".cow"
+#define COW_MAGIC               0x574f4344               /* "DCOW" */
+#define SNAP_CHUNK              (1024 * 1024)            /* 逐块复制时的块大小 */
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+/**
+ * 宿主文件系统不支持reflink时，恢复快照改为挂载写时复制覆盖层：
+ * 快照文件作为只读底层，设备文件清空后只保存恢复之后写入的块，
+ * 位图记录哪些块在设备文件中。覆盖层状态保存在设备文件旁的
+ * <设备>.cow中，跨进程重新打开设备时恢复
+ */
+struct cow_hdr
+{
+    uint32_t magic;
+    uint32_t iounit_size;
+    uint64_t disk_size;
+    char     base[PATH_MAX];
+};
+
+struct ddriver_overlay
+{
+    int               active;
+    int               base_fd;
+    atomic_int        dirty;                          /* 位图有未保存的修改 */
+    size_t            nr_words;
+    _Atomic uint64_t *bits;
+    char              base[PATH_MAX];
+    char              sidecar[PATH_MAX];
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static struct ddriver_overlay ov = {
+    .active  = 0,
+    .base_fd = -1
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static int ov_test(uint64_t blk) {
+    return (atomic_load_explicit(&ov.bits[blk / 64], memory_order_acquire) >> (blk % 64)) & 1;
+}
+
+static void ov_set(uint64_t blk) {
+    atomic_fetch_or_explicit(&ov.bits[blk / 64], 1ULL << (blk % 64), memory_order_release);
+}
+
+static int ov_alloc(void) {
+    uint64_t nr_blks = disk.layout_size / disk.iounit_size;
+
+    ov.nr_words = (nr_blks + 63) / 64;
+    ov.bits     = calloc(ov.nr_words, sizeof(uint64_t));
+    return ov.bits == NULL ? -ENOMEM : 0;
+}
+
+static void ov_detach(void) {
+    if (ov.base_fd >= 0) {
+        close(ov.base_fd);
+    }
+    free(ov.bits);
+    ov.bits    = NULL;
+    ov.base_fd = -1;
+    ov.active  = 0;
+    unlink(ov.sidecar);
+}
+
+/* 先写临时文件再rename，保证<设备>.cow总是完整的 */
+static int ov_save(void) {
+    struct cow_hdr hdr;
+    char   tmp[PATH_MAX + 8];
+    size_t size = ov.nr_words * sizeof(uint64_t);
+    int    fd, ok;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic       = COW_MAGIC;
+    hdr.iounit_size = disk.iounit_size;
+    hdr.disk_size   = disk.layout_size;
+    snprintf(hdr.base, sizeof(hdr.base), "%s", ov.base);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ov.sidecar);
+    fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+        return -errno;
+    }
+    atomic_store(&ov.dirty, 0);
+    ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+         write(fd, (void *)ov.bits, size) == (ssize_t)size &&
+         fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp, ov.sidecar) < 0) {
+        atomic_store(&ov.dirty, 1);
+        unlink(tmp);
+        return -EIO;
+    }
+    return 0;
+}
+
+static int is_clone_unsupported(int err) {
+    return err == EOPNOTSUPP || err == ENOTTY || err == EXDEV ||
+           err == EINVAL || err == ENOSYS;
+}
+
+/* 没有reflink或设备处于覆盖层时，逐块读出设备内容写入dst，跳过全0块保持稀疏 */
+static int snap_copy(int dst) {
+    static const char zero[SNAP_CHUNK];
+    struct iovec iov;
+    char  *buf = malloc(SNAP_CHUNK);
+    int    ret = 0;
+
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    for (off_t off = 0; off < disk.layout_size && ret == 0; off += SNAP_CHUNK) {
+        size_t n = disk.layout_size - off < SNAP_CHUNK ? disk.layout_size - off : SNAP_CHUNK;
+        iov.iov_base = buf;
+        iov.iov_len  = n;
+        if (store_readv(disk.ddriver_fd, &iov, 1, off, DDRIVER_MIRROR_ANY) != (ssize_t)n) {
+            ret = -EIO;
+        }
+        else if (memcmp(buf, zero, n) != 0 && pwrite(dst, buf, n, off) != (ssize_t)n) {
+            ret = -EIO;
+        }
+    }
+    free(buf);
+    if (ret == 0 && ftruncate(dst, disk.layout_size) < 0) {
+        ret = -errno;
+    }
+    return ret;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 打开设备时恢复覆盖层，<设备>.cow不存在时什么也不做
+ *
+ * @param device 设备文件路径
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_overlay_load(const char *device) {
+    struct cow_hdr hdr;
+    size_t size;
+    int    fd, ret = 0;
+
+    snprintf(ov.sidecar, sizeof(ov.sidecar), "%s" COW_SUFFIX, device);
+    fd = open(ov.sidecar, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != COW_MAGIC) {
+        user_panic("bad overlay [%s]", ov.sidecar);
+        ret = -EINVAL;
+    }
+    else if (hdr.iounit_size != (uint32_t)disk.iounit_size ||
+             hdr.disk_size != (uint64_t)disk.layout_size) {
+        user_panic("overlay [%s] was created for another geometry", ov.sidecar);
+        ret = -EINVAL;
+    }
+    else if (disk.map != NULL) {
+        user_panic("overlay [%s] can't be used in mmap mode", ov.sidecar);
+        ret = -ENOTSUP;
+    }
+    else if (ddriver_array_active()) {
+        user_panic("overlay [%s] can't be used with an array", ov.sidecar);
+        ret = -ENOTSUP;
+    }
+    else if (ov_alloc() < 0) {
+        ret = -ENOMEM;
+    }
+    if (ret == 0) {
+        size = ov.nr_words * sizeof(uint64_t);
+        snprintf(ov.base, sizeof(ov.base), "%s", hdr.base);
+        ov.base_fd = open(ov.base, O_RDONLY);
+        if (ov.base_fd < 0 || read(fd, (void *)ov.bits, size) != (ssize_t)size) {
+            user_panic("can't load overlay base [%s]", ov.base);
+            ret = -EIO;
+        }
+    }
+    close(fd);
+    if (ret < 0) {
+        if (ov.base_fd >= 0)
+            close(ov.base_fd);
+        free(ov.bits);
+        ov.bits    = NULL;
+        ov.base_fd = -1;
+        return ret;
+    }
+    atomic_store(&ov.dirty, 0);
+    ov.active = 1;
+    user_info("copy-on-write overlay on [%s]", ov.base);
+    return 0;
+}
+/**
+ * @brief 是否处于覆盖层模式
+ *
+ * @return int
+ */
+int ddriver_overlay_active(void) {
+    return ov.active;
+}
+/**
+ * @brief 覆盖层模式下读：已写过的块读设备文件，其余读快照
+ *
+ * @param iov
+ * @param iovcnt
+ * @param offset
+ * @return ssize_t 读出的字节数，失败返回-1
+ */
+ssize_t ddriver_overlay_readv(const struct iovec *iov, int iovcnt, off_t offset) {
+    ssize_t done = 0;
+
+    for (int k = 0; k < iovcnt; k++) {
+        char  *p   = iov[k].iov_base;
+        size_t len = iov[k].iov_len;
+        while (len > 0) {
+            uint64_t blk = offset / disk.iounit_size;
+            int      upper = ov_test(blk);
+            size_t   run = disk.iounit_size;
+            while (run < len && ov_test(blk + run / disk.iounit_size) == upper) {
+                run += disk.iounit_size;
+            }
+            if (pread(upper ? disk.ddriver_fd : ov.base_fd, p, run, offset) != (ssize_t)run) {
+                return -1;
+            }
+            p      += run;
+            len    -= run;
+            offset += run;
+            done   += run;
+        }
+    }
+    return done;
+}
+/**
+ * @brief 覆盖层模式下写：写入设备文件，落盘后再置位，并发读不会读到空洞
+ *
+ * @param iov
+ * @param iovcnt
+ * @param offset
+ * @return ssize_t 写入的字节数，失败返回-1
+ */
+ssize_t ddriver_overlay_writev(const struct iovec *iov, int iovcnt, off_t offset) {
+    ssize_t done = pwritev(disk.ddriver_fd, iov, iovcnt, offset);
+
+    if (done > 0) {
+        for (off_t pos = offset; pos < offset + done; pos += disk.iounit_size) {
+            ov_set(pos / disk.iounit_size);
+        }
+        atomic_store(&ov.dirty, 1);
+    }
+    return done;
+}
+/**
+ * @brief 标记区间已在设备文件中，discard打洞后读出为0而不是快照内容
+ *
+ * @param offset
+ * @param size
+ */
+void ddriver_overlay_mark(off_t offset, off_t size) {
+    if (!ov.active) {
+        return;
+    }
+    for (off_t pos = offset; pos < offset + size; pos += disk.iounit_size) {
+        ov_set(pos / disk.iounit_size);
+    }
+    atomic_store(&ov.dirty, 1);
+}
+/**
+ * @brief 保存覆盖层位图，由ddriver_flush与最后一次ddriver_close调用
+ *
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_overlay_sync(void) {
+    if (!ov.active || !atomic_load(&ov.dirty)) {
+        return 0;
+    }
+    return ov_save();
+}
+/**
+ * @brief 关闭覆盖层，由最后一次ddriver_close调用
+ */
+void ddriver_overlay_close(void) {
+    if (!ov.active) {
+        return;
+    }
+    close(ov.base_fd);
+    free(ov.bits);
+    ov.bits    = NULL;
+    ov.base_fd = -1;
+    ov.active  = 0;
+}
+/**
+ * @brief 丢弃覆盖层，设备内容与快照不再相关时 (如RESET) 调用
+ */
+void ddriver_overlay_drop(void) {
+    if (ov.active) {
+        ov_detach();
+    }
+}
+/**
+ * @brief 将设备当前内容保存为快照文件：优先reflink，常数时间且不占
+ *        额外空间；否则稀疏复制
+ *
+ * @param path 快照文件路径，已存在时覆盖
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_snapshot_save(const char *path) {
+    char tmp[PATH_MAX + 8];
+    int  dst, ret;
+
+    ret = ddriver_flush(disk.ddriver_fd);
+    if (ret < 0) {
+        return ret;
+    }
+    /* 快照可能正是覆盖层的底层，写临时文件再rename，底层fd仍指向旧文件 */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    dst = open(tmp, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (dst < 0) {
+        user_panic("can't create snapshot [%s]: %s", tmp, strerror(errno));
+        return -errno;
+    }
+    if (ov.active || ddriver_array_active()) {      /* 内容不在单个文件中，只能复制 */
+        ret = snap_copy(dst);
+    }
+    else if (ioctl(dst, FICLONE, disk.ddriver_fd) == 0) {
+        ret = 0;
+    }
+    else if (is_clone_unsupported(errno)) {
+        ret = snap_copy(dst);
+    }
+    else {
+        ret = -errno;
+    }
+    if (ret == 0 && fsync(dst) < 0) {
+        ret = -errno;
+    }
+    close(dst);
+    if (ret == 0 && rename(tmp, path) < 0) {
+        ret = -errno;
+    }
+    if (ret < 0) {
+        user_panic("snapshot [%s] failed: %s", path, strerror(-ret));
+        unlink(tmp);
+    }
+    return ret;
+}
+/**
+ * @brief 将设备恢复为快照内容：优先reflink覆盖设备文件；否则清空
+ *        设备文件并以快照为底层挂载覆盖层。两者耗时都与设备大小无关，
+ *        写缓存中的脏数据被丢弃
+ *
+ * @param path 快照文件路径，大小须与设备相同
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_snapshot_restore(const char *path) {
+    struct stat st;
+    int    src, ret = 0;
+
+    if (ddriver_array_active()) {
+        user_panic("snapshot restore is not supported on an array");
+        return -ENOTSUP;
+    }
+    src = open(path, O_RDONLY);
+    if (src < 0) {
+        user_panic("can't open snapshot [%s]: %s", path, strerror(errno));
+        return -errno;
+    }
+    if (fstat(src, &st) < 0 || st.st_size != disk.layout_size) {
+        user_panic("snapshot [%s] doesn't match disk size %ld", path, disk.layout_size);
+        close(src);
+        return -EINVAL;
+    }
+    ddriver_cache_drop();
+
+    if (ioctl(disk.ddriver_fd, FICLONE, src) == 0) {
+        close(src);
+        ddriver_overlay_drop();
+        return 0;
+    }
+    if (!is_clone_unsupported(errno)) {
+        ret = -errno;
+    }
+    else if (disk.map != NULL) {
+        user_panic("snapshot restore without reflink is not supported in mmap mode");
+        ret = -ENOTSUP;
+    }
+    if (ret < 0) {
+        close(src);
+        return ret;
+    }
+
+    ddriver_overlay_drop();
+    if (realpath(path, ov.base) == NULL) {
+        ret = -errno;
+        close(src);
+        return ret;
+    }
+    if (ov_alloc() < 0) {
+        close(src);
+        return -ENOMEM;
+    }
+    ov.base_fd = src;
+    if (ftruncate(disk.ddriver_fd, 0) < 0 ||
+        ftruncate(disk.ddriver_fd, disk.layout_size) < 0) {
+        ret = -errno;
+    }
+    else {
+        ret = ov_save();
+    }
+    if (ret < 0) {
+        ov_detach();
+        return ret;
+    }
+    ov.active = 1;
+    return 0;
+}
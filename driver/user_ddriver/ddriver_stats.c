@@ -0,0 +1,177 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "errno.h"
+#include "ddriver_core.h"
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+#define STAT_ADD(ctr, val)      (atomic_fetch_add_explicit(&(ctr), (val), memory_order_relaxed))
+#define STAT_GET(ctr)           (atomic_load_explicit(&(ctr), memory_order_relaxed))
+#define STAT_CLR(ctr)           (atomic_store_explicit(&(ctr), 0, memory_order_relaxed))
+
+static int lat_bucket(uint64_t us) {
+    int i = 0;
+    while (us != 0 && i < DDRIVER_LAT_BUCKETS - 1) {
+        us >>= 1;
+        i++;
+    }
+    return i;
+}
+
+static void stat_max(_Atomic uint64_t *ctr, uint64_t val) {
+    uint64_t old = STAT_GET(*ctr);
+    while (old < val && 
+           !atomic_compare_exchange_weak_explicit(ctr, &old, val, 
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+        ;
+    }
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 统计磁头移动距离
+ *
+ * @param from
+ * @param to
+ */
+void ddriver_stats_seek(off_t from, off_t to) {
+    STAT_ADD(disk.stats.seek_distance, to > from ? to - from : from - to);
+}
+/**
+ * @brief 统计一次请求，请求跨越多个区间时按重叠字节数分摊
+ *
+ * @param is_write
+ * @param offset
+ * @param size
+ * @param lat 模拟延迟 (us)，NODELAY下记为0
+ */
+void ddriver_stats_account(int is_write, off_t offset, size_t size, long lat) {
+    struct ddriver_counters *st = &disk.stats;
+    off_t    end = offset + size;
+    uint32_t nr  = disk.regions.nr;
+
+    if (disk.flags & DDRIVER_OPEN_NODELAY) {
+        lat = 0;
+    }
+    if (atomic_exchange(&st->last_end, end) == offset)
+        STAT_ADD(st->seq_accesses, 1);
+    else
+        STAT_ADD(st->rand_accesses, 1);
+    if (is_write)
+        STAT_ADD(st->bytes_written, size);
+    else
+        STAT_ADD(st->bytes_read, size);
+    STAT_ADD(st->lat_total_us, lat);
+    STAT_ADD(st->lat_hist[lat_bucket(lat)], 1);
+    stat_max(&st->lat_max_us, lat);
+
+    for (uint32_t i = 0; i < nr; i++) {
+        const struct ddriver_region *r = &disk.regions.region[i];
+        off_t lo = offset > (off_t)r->start ? offset : (off_t)r->start;
+        off_t hi = end < (off_t)r->end ? end : (off_t)r->end;
+        if (lo >= hi) {
+            continue;
+        }
+        if (is_write) {
+            STAT_ADD(st->region_writes[i], 1);
+            STAT_ADD(st->region_bytes_written[i], hi - lo);
+        }
+        else {
+            STAT_ADD(st->region_reads[i], 1);
+            STAT_ADD(st->region_bytes_read[i], hi - lo);
+        }
+    }
+}
+/**
+ * @brief 填充IOC_REQ_DEVICE_STATS的结果
+ *
+ * @param stats
+ */
+void ddriver_stats_fill(struct ddriver_stats *stats) {
+    struct ddriver_counters *st = &disk.stats;
+
+    memset(stats, 0, sizeof(struct ddriver_stats));
+    stats->version       = DDRIVER_STATS_VERSION;
+    stats->size          = sizeof(struct ddriver_stats);
+    stats->reads         = STAT_GET(disk.read_cnt);
+    stats->writes        = STAT_GET(disk.write_cnt);
+    stats->seeks         = STAT_GET(disk.seek_cnt);
+    stats->bytes_read    = STAT_GET(st->bytes_read);
+    stats->bytes_written = STAT_GET(st->bytes_written);
+    stats->seq_accesses  = STAT_GET(st->seq_accesses);
+    stats->rand_accesses = STAT_GET(st->rand_accesses);
+    stats->seek_distance = STAT_GET(st->seek_distance);
+    stats->lat_total_us  = STAT_GET(st->lat_total_us);
+    stats->lat_max_us    = STAT_GET(st->lat_max_us);
+    for (int i = 0; i < DDRIVER_LAT_BUCKETS; i++) {
+        stats->lat_hist[i] = STAT_GET(st->lat_hist[i]);
+    }
+    stats->nr_regions = disk.regions.nr;
+    for (uint32_t i = 0; i < disk.regions.nr; i++) {
+        stats->region[i].region        = disk.regions.region[i];
+        stats->region[i].reads         = STAT_GET(st->region_reads[i]);
+        stats->region[i].writes        = STAT_GET(st->region_writes[i]);
+        stats->region[i].bytes_read    = STAT_GET(st->region_bytes_read[i]);
+        stats->region[i].bytes_written = STAT_GET(st->region_bytes_written[i]);
+    }
+}
+/**
+ * @brief 清零所有统计，不擦除磁盘，也不移动磁头
+ */
+void ddriver_stats_reset(void) {
+    struct ddriver_counters *st = &disk.stats;
+
+    STAT_CLR(disk.read_cnt);
+    STAT_CLR(disk.write_cnt);
+    STAT_CLR(disk.seek_cnt);
+    STAT_CLR(disk.clock_us);
+    STAT_CLR(st->bytes_read);
+    STAT_CLR(st->bytes_written);
+    STAT_CLR(st->seq_accesses);
+    STAT_CLR(st->rand_accesses);
+    STAT_CLR(st->seek_distance);
+    STAT_CLR(st->lat_total_us);
+    STAT_CLR(st->lat_max_us);
+    for (int i = 0; i < DDRIVER_LAT_BUCKETS; i++) {
+        STAT_CLR(st->lat_hist[i]);
+    }
+    for (int i = 0; i < DDRIVER_REGION_MAX; i++) {
+        STAT_CLR(st->region_reads[i]);
+        STAT_CLR(st->region_writes[i]);
+        STAT_CLR(st->region_bytes_read[i]);
+        STAT_CLR(st->region_bytes_written[i]);
+    }
+    ddriver_sched_reset();
+    ddriver_cache_reset();
+    ddriver_queue_reset();
+}
+/**
+ * @brief 登记磁盘布局，之后的请求按区间分别统计；应在发起读写前调用
+ *
+ * @param regions
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_stats_set_regions(const struct ddriver_regions *regions) {
+    if (regions->nr > DDRIVER_REGION_MAX) {
+        user_alert("at most %d regions", DDRIVER_REGION_MAX);
+        return -EINVAL;
+    }
+    for (uint32_t i = 0; i < regions->nr; i++) {
+        if (regions->region[i].start >= regions->region[i].end) {
+            user_alert("empty region [%s]", regions->region[i].name);
+            return -EINVAL;
+        }
+    }
+    disk.regions = *regions;
+    for (uint32_t i = 0; i < disk.regions.nr; i++) {
+        disk.regions.region[i].name[DDRIVER_REGION_NAME_LEN - 1] = '\0';
+        STAT_CLR(disk.stats.region_reads[i]);
+        STAT_CLR(disk.stats.region_writes[i]);
+        STAT_CLR(disk.stats.region_bytes_read[i]);
+        STAT_CLR(disk.stats.region_bytes_written[i]);
+    }
+    return 0;
+}
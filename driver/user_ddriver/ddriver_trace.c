@@ -0,0 +1,248 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include "string.h"
+#include "errno.h"
+#include <pthread.h>
+#include <time.h>
+#include "ddriver_core.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define TRACE_RING_SZ           (1 << 16)                /* 必须是2的幂 */
+#define TRACE_RING_MASK         (TRACE_RING_SZ - 1)
+#define TRACE_FLUSH_MS          50                       /* 后台线程刷写周期 */
+#define TRACE_BATCH             1024                     /* 一次write的最多记录数 */
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+/**
+ * 多生产者单消费者环形队列：生产者CAS推进tail抢占槽位，槽位写满后
+ * 将seq置为pos + 1发布；消费者(刷写线程)按序收取已发布的槽位，
+ * 复位seq后再推进head。队列满时丢弃记录并计数，读写路径从不阻塞
+ */
+struct trace_slot
+{
+    _Atomic uint64_t         seq;
+    struct ddriver_trace_rec rec;
+};
+
+struct ddriver_trace
+{
+    int                 enabled;
+    int                 fd;
+    int                 stop;
+    uint64_t            start_ns;
+    pthread_t           flusher;
+    pthread_mutex_t     lock;                         /* 串行化消费者 */
+    pthread_cond_t      wake;
+    _Atomic uint64_t    head;
+    _Atomic uint64_t    tail;
+    _Atomic uint64_t    dropped;
+    uint64_t            written;
+    struct trace_slot  *ring;
+};
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+static struct ddriver_trace trace = {
+    .enabled = 0,
+    .fd      = -1,
+    .lock    = PTHREAD_MUTEX_INITIALIZER,
+    .wake    = PTHREAD_COND_INITIALIZER
+};
+
+static __thread uint16_t trace_tag = 0;
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+static uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int trace_write(const void *buf, size_t size) {
+    const char *p = buf;
+    while (size > 0) {
+        ssize_t n = write(trace.fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p    += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/* 收取所有已发布的记录写入文件，调用者持有trace.lock */
+static void trace_drain_locked(void) {
+    struct ddriver_trace_rec batch[TRACE_BATCH];
+    uint64_t pos = atomic_load_explicit(&trace.head, memory_order_relaxed);
+    int      nr;
+
+    do {
+        nr = 0;
+        while (nr < TRACE_BATCH) {
+            struct trace_slot *slot = &trace.ring[pos & TRACE_RING_MASK];
+            if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1) {
+                break;
+            }
+            batch[nr++] = slot->rec;
+            atomic_store_explicit(&slot->seq, pos + TRACE_RING_SZ, memory_order_relaxed);
+            pos++;
+        }
+        atomic_store_explicit(&trace.head, pos, memory_order_release);
+        if (nr > 0 && trace_write(batch, nr * sizeof(struct ddriver_trace_rec)) == 0) {
+            trace.written += nr;
+        }
+    } while (nr == TRACE_BATCH);
+}
+
+static void *trace_flusher(void *arg) {
+    struct timespec ts;
+    IGNORE_ARG(arg);
+
+    pthread_mutex_lock(&trace.lock);
+    while (!trace.stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += TRACE_FLUSH_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec  += 1;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&trace.wake, &trace.lock, &ts);
+        trace_drain_locked();
+    }
+    pthread_mutex_unlock(&trace.lock);
+    return NULL;
+}
+/******************************************************************************
+* SECTION: Global Function Implementation
+*******************************************************************************/
+/**
+ * @brief 开始记录请求轨迹，由ddriver_open在配置了trace时调用
+ *
+ * @param path 轨迹文件路径，已存在时覆盖
+ * @return int 0成功，否则返回负的错误号
+ */
+int ddriver_trace_start(const char *path) {
+    struct ddriver_trace_hdr hdr;
+
+    trace.fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (trace.fd < 0) {
+        user_panic("can't open trace [%s]: %s", path, strerror(errno));
+        return -errno;
+    }
+    trace.ring = calloc(TRACE_RING_SZ, sizeof(struct trace_slot));
+    if (trace.ring == NULL) {
+        close(trace.fd);
+        return -ENOMEM;
+    }
+    for (uint64_t i = 0; i < TRACE_RING_SZ; i++) {
+        atomic_init(&trace.ring[i].seq, i);
+    }
+    atomic_store(&trace.head, 0);
+    atomic_store(&trace.tail, 0);
+    atomic_store(&trace.dropped, 0);
+    trace.written  = 0;
+    trace.stop     = 0;
+    trace.start_ns = trace_now_ns();
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic       = DDRIVER_TRACE_MAGIC;
+    hdr.version     = DDRIVER_TRACE_VERSION;
+    hdr.iounit_size = disk.iounit_size;
+    hdr.track_num   = disk.track_num;
+    hdr.disk_size   = disk.layout_size;
+    if (trace_write(&hdr, sizeof(hdr)) < 0 ||
+        pthread_create(&trace.flusher, NULL, trace_flusher, NULL) != 0) {
+        user_panic("can't start trace [%s]", path);
+        free(trace.ring);
+        close(trace.fd);
+        return -EIO;
+    }
+    trace.enabled = 1;
+    return 0;
+}
+/**
+ * @brief 记录一次请求，无锁，队列满时丢弃
+ *
+ * @param op DDRIVER_OP_*
+ * @param offset
+ * @param size
+ * @param lat 模拟延迟 (us)
+ */
+void ddriver_trace_record(int op, off_t offset, size_t size, long lat) {
+    struct trace_slot *slot;
+    uint64_t pos, head;
+
+    if (!trace.enabled) {
+        return;
+    }
+    pos = atomic_load_explicit(&trace.tail, memory_order_relaxed);
+    do {
+        head = atomic_load_explicit(&trace.head, memory_order_acquire);
+        if (pos - head >= TRACE_RING_SZ) {
+            atomic_fetch_add_explicit(&trace.dropped, 1, memory_order_relaxed);
+            return;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&trace.tail, &pos, pos + 1,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed));
+    slot = &trace.ring[pos & TRACE_RING_MASK];
+    slot->rec.ts_ns  = trace_now_ns() - trace.start_ns;
+    slot->rec.offset = offset;
+    slot->rec.size   = size;
+    slot->rec.lat_us = lat;
+    slot->rec.op     = op;
+    slot->rec.tag    = trace_tag;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+/**
+ * @brief 将已记录的轨迹写入文件，由ddriver_flush调用
+ */
+void ddriver_trace_drain(void) {
+    if (!trace.enabled) {
+        return;
+    }
+    pthread_mutex_lock(&trace.lock);
+    trace_drain_locked();
+    pthread_mutex_unlock(&trace.lock);
+}
+/**
+ * @brief 停止记录并写完剩余轨迹，由最后一次ddriver_close调用
+ */
+void ddriver_trace_stop(void) {
+    if (!trace.enabled) {
+        return;
+    }
+    trace.enabled = 0;
+    pthread_mutex_lock(&trace.lock);
+    trace.stop = 1;
+    pthread_cond_signal(&trace.wake);
+    pthread_mutex_unlock(&trace.lock);
+    pthread_join(trace.flusher, NULL);
+
+    trace_drain_locked();
+    user_info("trace: %lu records, %lu dropped", trace.written,
+              atomic_load(&trace.dropped));
+    close(trace.fd);
+    free(trace.ring);
+    trace.ring = NULL;
+    trace.fd   = -1;
+}
+/**
+ * @brief 设置本线程之后请求的轨迹标签，便于区分元数据与数据等来源
+ *
+ * @param tag
+ * @return int 之前的标签
+ */
+int ddriver_trace_tag(int tag) {
+    int old = trace_tag;
+    trace_tag = (uint16_t)tag;
+    return old;
+}
@@ -3,12 +3,26 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
 
 int ddriver_open(char *path);
+int ddriver_open_flags(char *path, int flags);
+int ddriver_open_geometry(char *path, int flags, const struct ddriver_geometry *geo);
 int ddriver_seek(int fd, off_t offset, int whence);
 int ddriver_write(int fd, char *buf, size_t size);
 int ddriver_read(int fd, char *buf, size_t size);
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+int ddriver_writev_flags(int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags);
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
 int ddriver_close(int fd);
+void *ddriver_map(int fd, off_t offset, size_t size);
+int ddriver_flush(int fd);
+int ddriver_async_submit(int fd, struct ddriver_req *reqs, int nr);
+int ddriver_async_poll(int fd, struct ddriver_req **done, int max);
+int ddriver_async_wait(int fd, struct ddriver_req **done, int min, int max);
+int ddriver_trace_tag(int tag);
 
 #endif /* _DDRIVER_H_ */
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <sys/types.h>
+#include <stdint.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -13,9 +15,249 @@ struct ddriver_state
     int seek_cnt;
 };
 
-#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)                     /* 请求查看设备大小 */
+struct ddriver_geometry
+{
+    uint64_t disk_size;                                                     /* 设备大小 (字节) */
+    uint32_t iounit_size;                                                   /* 设备IO单位大小 */
+    uint32_t track_num;                                                     /* 磁道数 */
+};
+
+struct ddriver_range
+{
+    uint64_t offset;                                                        /* 起始偏移，对齐到设备IO单位 */
+    uint64_t length;                                                        /* 长度，设备IO单位的整数倍 */
+};
+
+#define DDRIVER_SNAPSHOT_PATH_LEN 1024
+
+struct ddriver_snapshot
+{
+    char path[DDRIVER_SNAPSHOT_PATH_LEN];                                   /* 快照文件路径，以'\0'结尾 */
+};
+
+#define DDRIVER_TOPO_DISCARD    0x1                                         /* 支持IOC_REQ_DEVICE_DISCARD，丢弃后读出为0 */
+#define DDRIVER_TOPO_FLUSH      0x2                                         /* 支持IOC_REQ_DEVICE_FLUSH */
+#define DDRIVER_TOPO_WCACHE     0x4                                         /* 有易失写缓存，FLUSH之后写入才持久 */
+#define DDRIVER_TOPO_ROTATIONAL 0x8                                         /* 有机械定位代价，顺序布局明显优于随机布局 */
+
+struct ddriver_topology
+{
+    uint64_t disk_size;                                                     /* 设备大小 (字节) */
+    uint32_t min_io_size;                                                   /* 最小IO大小，即设备IO单位 */
+    uint32_t optimal_io_size;                                               /* 传输时间与请求开销相当的请求大小，条带化时为整条带 */
+    uint32_t alignment;                                                     /* 请求偏移与长度的对齐要求 */
+    uint32_t max_transfer;                                                  /* 单次请求的最大字节数 */
+    uint32_t nr_queues;                                                     /* 可并行服务的硬件队列数 */
+    uint32_t queue_depth;                                                   /* 每个队列可同时服务的请求数 */
+    uint32_t flags;                                                         /* DDRIVER_TOPO_* */
+    uint32_t reserved;
+};
+
+#define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)                     /* 请求查看设备大小，超过2G时返回-EOVERFLOW */
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)    /* 请求设备状态，返回 ddriver_state */
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)                           /* 请求重置设备 */
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)                     /* 请求设备IO大小 */
+#define IOC_REQ_DEVICE_GEOMETRY _IOR(IOC_MAGIC, 4, struct ddriver_geometry) /* 请求设备几何参数，返回 ddriver_geometry */
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 5, uint64_t)                /* 请求查看设备大小 (64位) */
+#define IOC_REQ_DEVICE_CLOCK    _IOR(IOC_MAGIC, 6, uint64_t)                /* 请求模拟设备时间 (us)，RESET时清零 */
+#define IOC_REQ_DEVICE_SCHED    _IOR(IOC_MAGIC, 7, struct ddriver_sched_state) /* 请求调度统计，返回 ddriver_sched_state */
+#define IOC_REQ_DEVICE_STATS    _IOR(IOC_MAGIC, 8, struct ddriver_stats)    /* 请求详细统计，返回 ddriver_stats */
+#define IOC_REQ_DEVICE_STATS_RESET _IO(IOC_MAGIC, 9)                        /* 只清零统计，不擦除磁盘 */
+#define IOC_REQ_DEVICE_REGIONS  _IOW(IOC_MAGIC, 10, struct ddriver_regions) /* 登记按区间统计的磁盘布局 */
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 11)                          /* 写回写缓存并持久化到后端 */
+#define IOC_REQ_DEVICE_CACHE    _IOR(IOC_MAGIC, 12, struct ddriver_cache_state) /* 请求写缓存统计，返回 ddriver_cache_state */
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 13, struct ddriver_range)   /* 丢弃区间内容，之后读出为0，并释放后端空间 */
+#define IOC_REQ_DEVICE_SNAPSHOT _IOW(IOC_MAGIC, 14, struct ddriver_snapshot) /* 将设备内容保存为快照文件 */
+#define IOC_REQ_DEVICE_RESTORE  _IOW(IOC_MAGIC, 15, struct ddriver_snapshot) /* 将设备恢复为快照内容，耗时与设备大小无关 */
+#define IOC_REQ_DEVICE_QUEUES   _IOR(IOC_MAGIC, 16, struct ddriver_queues)  /* 请求各硬件队列统计，返回 ddriver_queues */
+#define IOC_REQ_DEVICE_TOPOLOGY _IOR(IOC_MAGIC, 17, struct ddriver_topology) /* 请求设备拓扑与能力，返回 ddriver_topology */
+#define IOC_REQ_DEVICE_BATCH    _IOWR(IOC_MAGIC, 18, struct ddriver_batch)  /* 批量执行请求描述符，返回成功的描述符数 */
+#define IOC_REQ_DEVICE_REAP     _IOR(IOC_MAGIC, 19, uint64_t)               /* 取走并清零已完成的异步批次数 */
+/******************************************************************************
+* SECTION: Open flags
+*******************************************************************************/
+#define DDRIVER_OPEN_MMAP       0x1                                         /* mmap方式打开，读写变为内存拷贝 */
+#define DDRIVER_OPEN_NODELAY    0x2                                         /* 不模拟寻道、旋转与传输延迟，用于纯CPU开销测试 */
+#define DDRIVER_OPEN_SIMCLOCK   0x4                                         /* 不休眠，只按模型推进模拟设备时间 */
+#define DDRIVER_OPEN_PREALLOC   0x8                                         /* 预分配后端文件，默认为稀疏文件 */
+#define DDRIVER_OPEN_DIRECT     0x10                                        /* 以O_DIRECT访问后端文件，绕过宿主页缓存 */
+/******************************************************************************
+* SECTION: Async request
+*******************************************************************************/
+#define DDRIVER_OP_READ         0                                           /* 读请求 */
+#define DDRIVER_OP_WRITE        1                                           /* 写请求 */
+#define DDRIVER_OP_WRITE_FUA    2                                           /* 写请求，绕过写缓存直接落盘 */
+#define DDRIVER_OP_DISCARD      3                                           /* 丢弃请求，buf不使用 */
+#define DDRIVER_OP_DESTAGE      4                                           /* 仅出现在轨迹中：写缓存的写回 */
+#define DDRIVER_ASYNC_DEPTH     256                                         /* 最多同时在途的异步请求数 */
+
+struct ddriver_req
+{
+    int     op;                                                             /* DDRIVER_OP_* */
+    char   *buf;
+    size_t  size;                                                           /* 设备IO单位的整数倍 */
+    off_t   offset;                                                         /* 对齐到设备IO单位 */
+    int     res;                                                            /* 完成后填入传输字节数或负的错误号 */
+    void   *user_data;                                                      /* 调用者自用，驱动不修改 */
+};
+
+/******************************************************************************
+* SECTION: Request scheduler
+*******************************************************************************/
+#define DDRIVER_SCHED_NOOP      0                                           /* 按提交顺序派发 */
+#define DDRIVER_SCHED_ELEVATOR  1                                           /* 按磁头位置双向扫描 (LOOK) */
+#define DDRIVER_SCHED_DEADLINE  2                                           /* 单向扫描，请求到期时优先服务 */
+
+struct ddriver_sched_state
+{
+    int      policy;                                                        /* DDRIVER_SCHED_* */
+    uint64_t submitted;                                                     /* 提交的请求数 */
+    uint64_t dispatched;                                                    /* 实际访问次数 */
+    uint64_t merged;                                                        /* 被合并进其他访问的请求数 */
+    uint64_t expired;                                                       /* deadline策略下因到期而优先服务的次数 */
+    uint64_t fifo_pos_us;                                                   /* 按提交顺序服务时的模拟定位时间 (us) */
+    uint64_t sched_pos_us;                                                  /* 按派发顺序服务时的模拟定位时间 (us) */
+};
+
+/******************************************************************************
+* SECTION: Statistics
+*******************************************************************************/
+#define DDRIVER_STATS_VERSION   1
+#define DDRIVER_LAT_BUCKETS     20                                          /* 第i个桶统计延迟在[2^(i-1), 2^i) us的请求，第0个桶为0us */
+#define DDRIVER_REGION_MAX      8
+#define DDRIVER_REGION_NAME_LEN 16
+
+struct ddriver_region
+{
+    uint64_t start;                                                         /* 区间 [start, end)，字节 */
+    uint64_t end;
+    char     name[DDRIVER_REGION_NAME_LEN];
+};
+
+struct ddriver_regions
+{
+    uint32_t nr;
+    struct ddriver_region region[DDRIVER_REGION_MAX];
+};
+
+struct ddriver_region_stats
+{
+    struct ddriver_region region;
+    uint64_t reads;                                                         /* 触及该区间的请求数 */
+    uint64_t writes;
+    uint64_t bytes_read;                                                    /* 落在该区间内的字节数 */
+    uint64_t bytes_written;
+};
+
+struct ddriver_stats
+{
+    uint32_t version;                                                       /* DDRIVER_STATS_VERSION */
+    uint32_t size;                                                          /* sizeof(struct ddriver_stats) */
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t seeks;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t seq_accesses;                                                  /* 紧接上一请求末尾的请求数 */
+    uint64_t rand_accesses;
+    uint64_t seek_distance;                                                 /* 磁头移动的累计字节数 */
+    uint64_t lat_total_us;                                                  /* 每请求延迟之和 */
+    uint64_t lat_max_us;
+    uint64_t lat_hist[DDRIVER_LAT_BUCKETS];
+    uint32_t nr_regions;
+    uint32_t reserved;
+    struct ddriver_region_stats region[DDRIVER_REGION_MAX];
+};
+
+/******************************************************************************
+* SECTION: Trace
+*******************************************************************************/
+#define DDRIVER_TRACE_MAGIC     0x43525444                                  /* "DTRC" */
+#define DDRIVER_TRACE_VERSION   1
+
+/* 轨迹文件：一个ddriver_trace_hdr，之后是若干ddriver_trace_rec */
+struct ddriver_trace_hdr
+{
+    uint32_t magic;                                                         /* DDRIVER_TRACE_MAGIC */
+    uint32_t version;
+    uint32_t iounit_size;                                                   /* 记录时的设备几何参数 */
+    uint32_t track_num;
+    uint64_t disk_size;
+};
+
+struct ddriver_trace_rec
+{
+    uint64_t ts_ns;                                                         /* 距开始记录的时间 */
+    uint64_t offset;
+    uint32_t size;
+    uint32_t lat_us;                                                        /* 记录时的模拟延迟 */
+    uint16_t op;                                                            /* DDRIVER_OP_* */
+    uint16_t tag;                                                           /* ddriver_trace_tag设置的调用者标签 */
+    uint32_t reserved;
+};
+
+/******************************************************************************
+* SECTION: Write cache
+*******************************************************************************/
+#define DDRIVER_WRITE_FUA       0x1                                         /* ddriver_writev_flags：本次写绕过写缓存直接落盘 */
+
+struct ddriver_cache_state
+{
+    uint64_t size;                                                          /* 写缓存大小 (字节)，0表示未启用 */
+    uint64_t dirty;                                                         /* 当前未落盘的字节数 */
+    uint64_t write_hits;                                                    /* 覆盖仍在缓存中的块的次数 (按IO单位) */
+    uint64_t read_hits;                                                     /* 完全由缓存服务的读请求数 */
+    uint64_t destages;                                                      /* 写回时的实际访问次数 */
+    uint64_t destaged_bytes;                                                /* 写回的字节数 */
+    uint64_t flushes;                                                       /* 显式flush次数 */
+};
+
+/******************************************************************************
+* SECTION: Hardware queues
+*******************************************************************************/
+#define DDRIVER_QUEUE_MAX       32                                          /* 最多硬件队列数 */
+
+struct ddriver_queue_stats
+{
+    uint64_t requests;                                                      /* 该队列服务的请求数 */
+    uint64_t bytes;                                                         /* 传输的字节数 */
+    uint64_t busy_us;                                                       /* 累计服务时间，除以设备时间为利用率 */
+    uint64_t wait_us;                                                       /* 累计排队等待时间 */
+    uint64_t lat_max_us;                                                    /* 最大完成延迟 (排队 + 服务) */
+    uint64_t full;                                                          /* 到达时队列已满、必须等待的次数 */
+    uint64_t occupancy_sum;                                                 /* 到达时占用数之和，除以requests为平均占用 */
+    uint64_t max_occupancy;                                                 /* 到达时的最大占用数 */
+};
+
+struct ddriver_queues
+{
+    uint32_t nr_queues;                                                     /* 硬件队列数，0表示未启用多队列模型 */
+    uint32_t depth;                                                         /* 每个队列的深度 */
+    struct ddriver_queue_stats queue[DDRIVER_QUEUE_MAX];
+};
+
+/******************************************************************************
+* SECTION: Batched requests
+*******************************************************************************/
+#define DDRIVER_BATCH_MAX       256                                         /* 一次提交的最多描述符数 */
+#define DDRIVER_BATCH_ASYNC     0x1                                         /* 提交后即返回，完成时通知eventfd并可poll */
+
+struct ddriver_iodesc
+{
+    uint32_t op;                                                            /* DDRIVER_OP_* */
+    int32_t  res;                                                           /* 驱动填入传输字节数或负的错误号 */
+    uint64_t offset;                                                        /* 对齐到设备IO单位 */
+    uint64_t length;                                                        /* 设备IO单位的整数倍 */
+    uint64_t buf;                                                           /* 用户缓冲区地址 */
+};
+
+struct ddriver_batch
+{
+    uint32_t nr;                                                            /* 描述符个数，不超过DDRIVER_BATCH_MAX */
+    uint32_t flags;                                                         /* DDRIVER_BATCH_* */
+    int32_t  eventfd;                                                       /* 异步批次完成时加1的eventfd，-1不通知 */
+    uint32_t reserved;
+    uint64_t descs;                                                         /* struct ddriver_iodesc数组的地址 */
+};
 
 #endif
\ No newline at end of file
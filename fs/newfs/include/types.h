@@ -15,8 +15,9 @@ struct newfs_super {
     int      fd;
     uint32_t io_size;             /* 设备IO大小 */
     uint32_t block_size;          /* 逻辑块大小 */
-    uint32_t disk_size;           /* 设备大小 */
+    uint64_t disk_size;           /* 设备大小 */
     uint32_t block_count;         /* 总逻辑块数 */
+    uint32_t dev_flags;           /* 设备能力，DDRIVER_TOPO_* */
 
     /* 磁盘布局 */
     uint32_t sb_offset;
@@ -40,6 +41,8 @@ struct newfs_super {
 
     uint8_t*  inode_map;
     uint8_t*  data_map;
+    uint8_t*  inode_table;        /* mmap方式打开时直接指向磁盘上的inode表 */
+    bool      maps_mapped;        /* 位图直接映射磁盘，无需刷写与释放 */
 
     struct newfs_dentry* root_dentry;
 };
@@ -11,7 +11,8 @@
 *******************************************************************************/
 #define OPTION(t, p)        { t, offsetof(struct custom_options, p), 1 }
 
-#define NEWFS_BLOCK_SIZE    1024
+#define NEWFS_BLOCK_SIZE    1024                        /* 最小逻辑块大小 */
+#define NEWFS_BLOCK_SIZE_MAX 4096                       /* 设备IO单位更大时逻辑块随之增大 */
 #define NEWFS_DIRECT_NUM    8
 #define BITS_PER_BYTE       8
 
@@ -129,6 +130,8 @@ static struct fuse_operations operations = {
         .read = newfs_read,                                     /* 读文件 */
         .utimens = newfs_utimens,                                /* 修改时间，忽略，避免touch报错 */
         .truncate = newfs_truncate,                              /* 改变文件大小 */
+        .fsync = newfs_fsync,                                    /* 持久化文件，fsync */
+        .fsyncdir = newfs_fsync,                                 /* 持久化目录 */
         .unlink = newfs_unlink,                                  /* 删除文件 */
         .rmdir  = newfs_rmdir,                                   /* 删除目录， rm -r */
         .rename = newfs_rename,                                  /* 重命名，mv */
@@ -528,6 +531,22 @@ int newfs_truncate(const char* path, off_t offset) {
         return 0;
 }
 
+/**
+ * @brief 持久化文件或目录。newfs的数据与元数据都在操作时写入设备，
+ *        但可能仍在设备写缓存中，因此只需让设备写回缓存
+ *
+ * @param path 相对于挂载点的路径
+ * @param datasync 非0时只需持久化数据，可忽略
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+        (void)path;
+        (void)datasync;
+        (void)fi;
+        return ddriver_ioctl(super.fd, IOC_REQ_DEVICE_FLUSH, NULL) < 0 ? -EIO : 0;
+}
+
 
 /**
  * @brief 访问文件，因为读写文件时需要查看权限
@@ -578,6 +597,87 @@ static uint32_t newfs_inodes_per_block(void) {
         return super.block_size / sizeof(struct newfs_inode_d);
 }
 
+/* 两张位图以一批异步请求同时读出 */
+static int newfs_load_maps(void) {
+        struct ddriver_req reqs[2] = {
+                { .op = DDRIVER_OP_READ, .buf = (char *)super.inode_map,
+                  .size = super.ino_map_blks * super.block_size,
+                  .offset = (off_t)super.ino_map_offset * super.block_size },
+                { .op = DDRIVER_OP_READ, .buf = (char *)super.data_map,
+                  .size = super.data_map_blks * super.block_size,
+                  .offset = (off_t)super.data_map_offset * super.block_size },
+        };
+        struct ddriver_req *done[2];
+        /* 挂载时已保证逻辑块是设备IO单位的整数倍，位图总是对齐的 */
+        int nr = ddriver_async_submit(super.fd, reqs, 2);
+        for (int got = 0; got < nr; ) {
+                got += ddriver_async_wait(super.fd, done, nr - got, 2);
+        }
+        if (nr < 2 || reqs[0].res < 0 || reqs[1].res < 0) {
+                return -EIO;
+        }
+        return 0;
+}
+
+/* 向驱动登记磁盘布局，使驱动统计按区域细分 */
+static void newfs_register_regions(void) {
+        struct ddriver_regions regions;
+        const struct { const char* name; uint32_t offset, blks; } layout[] = {
+                { "super",     super.sb_offset,       super.sb_blks },
+                { "inode_map", super.ino_map_offset,  super.ino_map_blks },
+                { "data_map",  super.data_map_offset, super.data_map_blks },
+                { "inode",     super.inode_offset,    super.inode_blks },
+                { "data",      super.data_offset,     super.data_blks },
+        };
+
+        memset(&regions, 0, sizeof(regions));
+        for (size_t i = 0; i < sizeof(layout) / sizeof(layout[0]); i++) {
+                struct ddriver_region* r = &regions.region[regions.nr++];
+                r->start = (uint64_t)layout[i].offset * super.block_size;
+                r->end = r->start + (uint64_t)layout[i].blks * super.block_size;
+                strncpy(r->name, layout[i].name, DDRIVER_REGION_NAME_LEN - 1);
+        }
+        ddriver_ioctl(super.fd, IOC_REQ_DEVICE_REGIONS, &regions);
+}
+
+/* 仅在inode表直接映射磁盘时可用 */
+static uint8_t* newfs_inode_slot(uint32_t ino) {
+        return super.inode_table
+               + (ino / newfs_inodes_per_block()) * super.block_size
+               + (ino % newfs_inodes_per_block()) * sizeof(struct newfs_inode_d);
+}
+
+/* 查询设备拓扑，旧驱动不支持时退回几何参数，按无丢弃、机械盘处理 */
+static int newfs_query_device(void) {
+        struct ddriver_topology topo;
+        struct ddriver_geometry geo;
+
+        /* 旧驱动可能只填写部分字段 */
+        memset(&topo, 0, sizeof(topo));
+        if (ddriver_ioctl(super.fd, IOC_REQ_DEVICE_TOPOLOGY, &topo) == 0 && topo.min_io_size != 0) {
+                super.io_size = topo.alignment > topo.min_io_size ? topo.alignment : topo.min_io_size;
+                super.disk_size = topo.disk_size;
+                super.dev_flags = topo.flags;
+                return 0;
+        }
+        if (ddriver_ioctl(super.fd, IOC_REQ_DEVICE_GEOMETRY, &geo) < 0) {
+                return -EIO;
+        }
+        super.io_size = geo.iounit_size;
+        super.disk_size = geo.disk_size;
+        super.dev_flags = DDRIVER_TOPO_ROTATIONAL;
+        return 0;
+}
+
+/* 逻辑块至少为设备的最小IO与对齐单位，避免读改写；不按最优请求大小放大，那会让小文件占用过多空间 */
+static uint32_t newfs_pick_block_size(void) {
+        uint32_t block_size = NEWFS_BLOCK_SIZE;
+        while (block_size < super.io_size && block_size < NEWFS_BLOCK_SIZE_MAX) {
+                block_size <<= 1;
+        }
+        return block_size;
+}
+
 static int newfs_mount(struct custom_options opt){
         struct newfs_super_d disk_super;
         bool is_init = false;
@@ -588,14 +688,8 @@ static int newfs_mount(struct custom_options opt){
                 return super.fd;
         }
 
-        ddriver_ioctl(super.fd, IOC_REQ_DEVICE_IO_SZ, &super.io_size);
-        ddriver_ioctl(super.fd, IOC_REQ_DEVICE_SIZE, &super.disk_size);
-
-        super.block_size = NEWFS_BLOCK_SIZE;
-        super.block_count = super.disk_size / super.block_size;
-
-        if (super.block_count < 5) {
-                return -ENOSPC;
+        if (newfs_query_device() < 0) {
+                return -EIO;
         }
 
         if (newfs_disk_read(0, &disk_super, sizeof(disk_super)) < 0 ||
@@ -604,6 +698,22 @@ static int newfs_mount(struct custom_options opt){
                 memset(&disk_super, 0, sizeof(disk_super));
         }
 
+        /* 格式化时按设备选择逻辑块大小，已有文件系统沿用超级块中的记录 */
+        super.block_size = is_init ? newfs_pick_block_size() : disk_super.block_size;
+        if (super.block_size < NEWFS_BLOCK_SIZE || super.block_size > NEWFS_BLOCK_SIZE_MAX ||
+            super.block_size % super.io_size != 0) {
+                return -EINVAL;
+        }
+        if (super.disk_size / super.block_size > UINT32_MAX) {
+                super.block_count = UINT32_MAX;
+        } else {
+                super.block_count = super.disk_size / super.block_size;
+        }
+
+        if (super.block_count < 5) {
+                return -ENOSPC;
+        }
+
         if (is_init) {
                 super.magic = NEWFS_MAGIC;
                 super.sb_offset = 0;
@@ -613,7 +723,9 @@ static int newfs_mount(struct custom_options opt){
                 super.ino_map_blks = 1;
 
                 super.data_map_offset = super.ino_map_offset + super.ino_map_blks;
-                super.data_map_blks = 1;
+                /* 数据位图按设备大小伸缩，每个逻辑块对应一位 */
+                super.data_map_blks = (super.block_count + super.block_size * BITS_PER_BYTE - 1)
+                                      / (super.block_size * BITS_PER_BYTE);
 
                 super.inode_offset = super.data_map_offset + super.data_map_blks;
                 super.inode_blks = 1;
@@ -622,7 +734,7 @@ static int newfs_mount(struct custom_options opt){
                 super.data_blks = super.block_count - super.data_offset;
 
                 uint32_t max_ino_bits = super.ino_map_blks * super.block_size * BITS_PER_BYTE;
-                uint32_t max_data_bits = super.data_map_blks * super.block_size * BITS_PER_BYTE;
+                uint64_t max_data_bits = (uint64_t)super.data_map_blks * super.block_size * BITS_PER_BYTE;
 
                 super.inode_count = newfs_inodes_per_block() * super.inode_blks;
                 if (super.inode_count > max_ino_bits) {
@@ -654,20 +766,27 @@ static int newfs_mount(struct custom_options opt){
                 newfs_load_super(&disk_super);
         }
 
-        super.inode_map = calloc(super.ino_map_blks, super.block_size);
-        super.data_map = calloc(super.data_map_blks, super.block_size);
+        newfs_register_regions();
+
+        /* 设备以mmap方式打开时，位图与inode表直接访问磁盘，免去拷贝 */
+        super.inode_map = ddriver_map(super.fd, (off_t)super.ino_map_offset * super.block_size,
+                                      super.ino_map_blks * super.block_size);
+        super.data_map = ddriver_map(super.fd, (off_t)super.data_map_offset * super.block_size,
+                                     super.data_map_blks * super.block_size);
+        super.inode_table = ddriver_map(super.fd, (off_t)super.inode_offset * super.block_size,
+                                        super.inode_blks * super.block_size);
+        super.maps_mapped = super.inode_map && super.data_map;
+        if (!super.maps_mapped) {
+                super.inode_map = calloc(super.ino_map_blks, super.block_size);
+                super.data_map = calloc(super.data_map_blks, super.block_size);
+        }
         if (!super.inode_map || !super.data_map) {
                 return -ENOMEM;
         }
 
         if (!is_init) {
-                for (uint32_t i = 0; i < super.ino_map_blks; i++) {
-                        newfs_block_read(super.ino_map_offset + i,
-                                          super.inode_map + i * super.block_size);
-                }
-                for (uint32_t i = 0; i < super.data_map_blks; i++) {
-                        newfs_block_read(super.data_map_offset + i,
-                                          super.data_map + i * super.block_size);
+                if (!super.maps_mapped && newfs_load_maps() < 0) {
+                        return -EIO;
                 }
                 return newfs_prepare_root();
         }
@@ -675,6 +794,17 @@ static int newfs_mount(struct custom_options opt){
         memset(super.inode_map, 0, super.ino_map_blks * super.block_size);
         memset(super.data_map, 0, super.data_map_blks * super.block_size);
 
+        /* 新格式化的数据区不含有效数据，交给设备丢弃，释放后端空间 */
+        struct ddriver_range range;
+        off_t data_start = round_up((off_t)super.data_offset * super.block_size, super.io_size);
+        off_t data_end = round_down((off_t)(super.data_offset + super.data_blks) * super.block_size,
+                                    super.io_size);
+        if (data_end > data_start) {
+                range.offset = data_start;
+                range.length = data_end - data_start;
+                ddriver_ioctl(super.fd, IOC_REQ_DEVICE_DISCARD, &range);
+        }
+
         /* 分配根目录 */
         int root_ino = newfs_alloc_inode();
         struct newfs_inode root_inode;
@@ -688,9 +818,13 @@ static int newfs_mount(struct custom_options opt){
         super.root_ino = (uint32_t)root_ino;
         disk_super.root_ino = super.root_ino;
 
-        newfs_sync_super(&disk_super);
         newfs_flush_inode_map();
         newfs_flush_data_map();
+        /* 位图与根目录落盘后再写超级块，超级块有效即格式化完成 */
+        if (ddriver_ioctl(super.fd, IOC_REQ_DEVICE_FLUSH, NULL) < 0 ||
+            newfs_sync_super(&disk_super) < 0) {
+                return -EIO;
+        }
         return newfs_prepare_root();
 }
 
@@ -726,15 +860,17 @@ static int newfs_umount(void){
                 newfs_free_dentry_tree(super.root_dentry);
                 super.root_dentry = NULL;
         }
-        if (super.inode_map) {
+        if (super.inode_map && !super.maps_mapped) {
                 free(super.inode_map);
-                super.inode_map = NULL;
         }
-        if (super.data_map) {
+        if (super.data_map && !super.maps_mapped) {
                 free(super.data_map);
-                super.data_map = NULL;
         }
+        super.inode_map = NULL;
+        super.data_map = NULL;
+        super.inode_table = NULL;
         if (super.fd > 0) {
+                ddriver_flush(super.fd);
                 ddriver_close(super.fd);
                 super.fd = -1;
         }
@@ -759,18 +895,18 @@ static int newfs_disk_read(off_t offset, void *buf, size_t size){
         }
 
         size_t span = (size_t)(up - down);
+        if (down == offset && span == size) {            /* 已对齐，直接读入buf */
+                return ddriver_pread(super.fd, buf, size, offset) < 0 ? -EIO : 0;
+        }
+
         uint8_t *tmp = malloc(span);
         if (!tmp) {
                 return -ENOMEM;
         }
 
-        for (off_t pos = down; pos < up; pos += io_sz) {
-                size_t buf_off = (size_t)(pos - down);
-                if (ddriver_seek(super.fd, pos, SEEK_SET) < 0 ||
-                    ddriver_read(super.fd, (char *)tmp + buf_off, io_sz) < 0) {
-                        free(tmp);
-                        return -EIO;
-                }
+        if (ddriver_pread(super.fd, (char *)tmp, span, down) < 0) {
+                free(tmp);
+                return -EIO;
         }
 
         size_t bias = (size_t)(offset - down);
@@ -798,30 +934,26 @@ static int newfs_disk_write(off_t offset, const void *buf, size_t size){
         }
 
         size_t span = (size_t)(up - down);
+        if (down == offset && span == size) {            /* 已对齐，无需读改写 */
+                return ddriver_pwrite(super.fd, (char *)buf, size, offset) < 0 ? -EIO : 0;
+        }
+
         uint8_t *tmp = malloc(span);
         if (!tmp) {
                 return -ENOMEM;
         }
 
-        for (off_t pos = down; pos < up; pos += io_sz) {
-                size_t buf_off = (size_t)(pos - down);
-                if (ddriver_seek(super.fd, pos, SEEK_SET) < 0 ||
-                    ddriver_read(super.fd, (char *)tmp + buf_off, io_sz) < 0) {
-                        free(tmp);
-                        return -EIO;
-                }
+        if (ddriver_pread(super.fd, (char *)tmp, span, down) < 0) {
+                free(tmp);
+                return -EIO;
         }
 
         size_t bias = (size_t)(offset - down);
         memcpy(tmp + bias, buf, size);
 
-        for (off_t pos = down; pos < up; pos += io_sz) {
-                size_t buf_off = (size_t)(pos - down);
-                if (ddriver_seek(super.fd, pos, SEEK_SET) < 0 ||
-                    ddriver_write(super.fd, (char *)tmp + buf_off, io_sz) < 0) {
-                        free(tmp);
-                        return -EIO;
-                }
+        if (ddriver_pwrite(super.fd, (char *)tmp, span, down) < 0) {
+                free(tmp);
+                return -EIO;
         }
 
         free(tmp);
@@ -829,27 +961,11 @@ static int newfs_disk_write(off_t offset, const void *buf, size_t size){
 }
 
 static int newfs_block_read(uint32_t blkno, void *buf){
-        uint32_t io_cnt = super.block_size / super.io_size;
-        off_t base = (off_t)blkno * super.block_size;
-        for (uint32_t i = 0; i < io_cnt; i++) {
-                ddriver_seek(super.fd, base + i * super.io_size, SEEK_SET);
-                if (ddriver_read(super.fd, (char *)buf + i * super.io_size, super.io_size) < 0) {
-                        return -EIO;
-                }
-        }
-        return 0;
+        return newfs_disk_read((off_t)blkno * super.block_size, buf, super.block_size);
 }
 
 static int newfs_block_write(uint32_t blkno, const void *buf){
-        uint32_t io_cnt = super.block_size / super.io_size;
-        off_t base = (off_t)blkno * super.block_size;
-        for (uint32_t i = 0; i < io_cnt; i++) {
-                ddriver_seek(super.fd, base + i * super.io_size, SEEK_SET);
-                if (ddriver_write(super.fd, (char *)buf + i * super.io_size, super.io_size) < 0) {
-                        return -EIO;
-                }
-        }
-        return 0;
+        return newfs_disk_write((off_t)blkno * super.block_size, buf, super.block_size);
 }
 
 static bool bitmap_test(uint8_t *map, uint32_t idx){
@@ -865,17 +981,19 @@ static void bitmap_clear(uint8_t *map, uint32_t idx){
 }
 
 static int newfs_flush_inode_map(void){
-        for (uint32_t i = 0; i < super.ino_map_blks; i++) {
-                newfs_block_write(super.ino_map_offset + i, super.inode_map + i * super.block_size);
+        if (super.maps_mapped) {
+                return 0;
         }
-        return 0;
+        return newfs_disk_write((off_t)super.ino_map_offset * super.block_size,
+                                super.inode_map, super.ino_map_blks * super.block_size);
 }
 
 static int newfs_flush_data_map(void){
-        for (uint32_t i = 0; i < super.data_map_blks; i++) {
-                newfs_block_write(super.data_map_offset + i, super.data_map + i * super.block_size);
+        if (super.maps_mapped) {
+                return 0;
         }
-        return 0;
+        return newfs_disk_write((off_t)super.data_map_offset * super.block_size,
+                                super.data_map, super.data_map_blks * super.block_size);
 }
 
 static int newfs_alloc_inode(void){
@@ -887,7 +1005,11 @@ static int newfs_alloc_inode(void){
                         memset(&zero, 0, sizeof(zero));
                         uint32_t blk = super.inode_offset + i / newfs_inodes_per_block();
                         uint32_t off = (i % newfs_inodes_per_block()) * sizeof(struct newfs_inode_d);
-                        char buf[NEWFS_BLOCK_SIZE];
+                        if (super.inode_table) {
+                                memcpy(newfs_inode_slot(i), &zero, sizeof(zero));
+                                return (int)i;
+                        }
+                        char buf[NEWFS_BLOCK_SIZE_MAX];
                         newfs_block_read(blk, buf);
                         memcpy(buf + off, &zero, sizeof(zero));
                         newfs_block_write(blk, buf);
@@ -902,7 +1024,16 @@ static int newfs_alloc_data_block(void){
                 if (!bitmap_test(super.data_map, i)) {
                         bitmap_set(super.data_map, i);
                         newfs_flush_data_map();
-                        char zero[NEWFS_BLOCK_SIZE];
+                        /* 设备支持丢弃时直接丢弃得到全0的块，只付请求开销，不传输数据 */
+                        struct ddriver_range range = {
+                                .offset = (uint64_t)(super.data_offset + i) * super.block_size,
+                                .length = super.block_size
+                        };
+                        if ((super.dev_flags & DDRIVER_TOPO_DISCARD) &&
+                            ddriver_ioctl(super.fd, IOC_REQ_DEVICE_DISCARD, &range) == 0) {
+                                return (int)(super.data_offset + i);
+                        }
+                        char zero[NEWFS_BLOCK_SIZE_MAX];
                         memset(zero, 0, sizeof(zero));
                         newfs_block_write(super.data_offset + i, zero);
                         return (int)(super.data_offset + i);
@@ -917,10 +1048,14 @@ static int newfs_read_inode(uint32_t ino, struct newfs_inode *inode){
         }
         uint32_t blk = super.inode_offset + ino / newfs_inodes_per_block();
         uint32_t off = (ino % newfs_inodes_per_block()) * sizeof(struct newfs_inode_d);
-        char buf[NEWFS_BLOCK_SIZE];
+        char buf[NEWFS_BLOCK_SIZE_MAX];
         struct newfs_inode_d disk_inode;
-        newfs_block_read(blk, buf);
-        memcpy(&disk_inode, buf + off, sizeof(disk_inode));
+        if (super.inode_table) {
+                memcpy(&disk_inode, newfs_inode_slot(ino), sizeof(disk_inode));
+        } else {
+                newfs_block_read(blk, buf);
+                memcpy(&disk_inode, buf + off, sizeof(disk_inode));
+        }
 
         inode->ino = ino;
         inode->mode = disk_inode.mode;
@@ -940,13 +1075,17 @@ static int newfs_write_inode(const struct newfs_inode *inode){
         }
         uint32_t blk = super.inode_offset + inode->ino / newfs_inodes_per_block();
         uint32_t off = (inode->ino % newfs_inodes_per_block()) * sizeof(struct newfs_inode_d);
-        char buf[NEWFS_BLOCK_SIZE];
+        char buf[NEWFS_BLOCK_SIZE_MAX];
         struct newfs_inode_d disk_inode;
-        newfs_block_read(blk, buf);
         disk_inode.mode = inode->mode;
         disk_inode.size = inode->size;
         disk_inode.links = inode->links;
         memcpy(disk_inode.blocks, inode->blocks, sizeof(disk_inode.blocks));
+        if (super.inode_table) {
+                memcpy(newfs_inode_slot(inode->ino), &disk_inode, sizeof(disk_inode));
+                return 0;
+        }
+        newfs_block_read(blk, buf);
         memcpy(buf + off, &disk_inode, sizeof(disk_inode));
         newfs_block_write(blk, buf);
         return 0;
@@ -994,7 +1133,7 @@ static int newfs_load_dir_children(struct newfs_inode *dir, struct newfs_dentry
                 if (blk_idx >= NEWFS_DIRECT_NUM || dir->blocks[blk_idx] == 0) {
                         continue;
                 }
-                char buf[NEWFS_BLOCK_SIZE];
+                char buf[NEWFS_BLOCK_SIZE_MAX];
                 if (newfs_block_read(dir->blocks[blk_idx], buf) < 0) {
                         continue;
                 }
@@ -1116,7 +1255,7 @@ static int newfs_lookup_in_dir(struct newfs_inode *dir, const char *name,
                 }
         }
         uint32_t cnt = dir->size / sizeof(struct newfs_dentry_d);
-        char buf[NEWFS_BLOCK_SIZE];
+        char buf[NEWFS_BLOCK_SIZE_MAX];
         struct newfs_dentry_d tmp;
         for (uint32_t i = 0; i < cnt; i++) {
                 uint32_t blk_idx = (i * sizeof(struct newfs_dentry_d)) / super.block_size;
@@ -1189,7 +1328,7 @@ static int newfs_add_dentry(struct newfs_inode *dir, const char *name,
                 dir->blocks[blk_idx] = (uint32_t)new_blk;
         }
 
-        char buf[NEWFS_BLOCK_SIZE];
+        char buf[NEWFS_BLOCK_SIZE_MAX];
         newfs_block_read(dir->blocks[blk_idx], buf);
         memcpy(buf + blk_off, &entry, sizeof(entry));
         newfs_block_write(dir->blocks[blk_idx], buf);
@@ -1372,5 +1511,9 @@ static int newfs_load_super(struct newfs_super_d *disk_super){
 }
 
 static int newfs_sync_super(const struct newfs_super_d *disk_super){
-        return newfs_disk_write(0, disk_super, sizeof(*disk_super));
+        int ret = newfs_disk_write(0, disk_super, sizeof(*disk_super));
+        if (ret == 0 && ddriver_ioctl(super.fd, IOC_REQ_DEVICE_FLUSH, NULL) < 0) {
+                ret = -EIO;
+        }
+        return ret;
 }
@@ -59,6 +59,7 @@ int   			   sfs_rmdir(const char *);
 int   			   sfs_rename(const char *, const char *);
 int   			   sfs_utimens(const char *, const struct timespec tv[2]);
 int   			   sfs_truncate(const char *, off_t);
+int   			   sfs_fsync(const char *, int, struct fuse_file_info *);
 int 			   sfs_symlink(const char *, const char *);
 int 			   sfs_readlink(const char *, char *, size_t);
 			
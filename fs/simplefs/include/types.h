@@ -105,7 +105,7 @@ struct sfs_super
     int                driver_fd;
     
     int                sz_io;
-    int                sz_disk;
+    uint64_t           sz_disk;
     int                sz_usage;
     
     int                max_ino;
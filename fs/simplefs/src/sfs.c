@@ -30,6 +30,7 @@ static struct fuse_operations operations = {
 	.read = sfs_read,								  /* 读文件 */
 	.utimens = sfs_utimens,							  /* 修改时间，忽略，避免touch报错 */
 	.truncate = sfs_truncate,						  /* 改变文件大小 */
+	.fsync = sfs_fsync,								  /* 持久化文件，fsync */
 	.unlink = sfs_unlink,							  /* 删除文件 */
 	.rmdir	= sfs_rmdir,							  /* 删除目录， rm -r */
 	.rename = sfs_rename,							  /* 重命名，mv */
@@ -495,6 +496,27 @@ int sfs_truncate(const char* path, off_t offset) {
 
 	return SFS_ERROR_NONE;
 }
+/**
+ * @brief 将文件的inode与数据刷回磁盘，并让设备写回写缓存
+ * 
+ * @param path 
+ * @param datasync 
+ * @param fi 
+ * @return int 
+ */
+int sfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct sfs_dentry* dentry = sfs_lookup(path, &is_find, &is_root);
+
+	if (is_find == FALSE) {
+		return -SFS_ERROR_NOTFOUND;
+	}
+	if (sfs_sync_inode(dentry->inode) != SFS_ERROR_NONE ||
+		ddriver_ioctl(SFS_DRIVER(), IOC_REQ_DEVICE_FLUSH, NULL) < 0) {
+		return -SFS_ERROR_IO;
+	}
+	return SFS_ERROR_NONE;
+}
 /**
  * @brief 展示sfs用法
  * 
@@ -3,17 +3,52 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
+
+/*
+ * 并发约定：
+ *   - 所有接口均可被多个线程并发调用，统计计数为原子计数
+ *   - ddriver_pread/pwrite/readv/writev与异步接口自带偏移，互不干扰，多线程下推荐使用
+ *   - ddriver_seek + ddriver_read/write 的游标按线程保存，不同线程的游标互不影响
+ *   - 同一设备可多次打开，共享设备状态，各自得到独立的fd；最后一次ddriver_close释放设备
+ *   - 并发写同一区间时，结果为其中某一次写入，不保证顺序
+ *   - IOC_REQ_DEVICE_RESET与ddriver_close不得与读写并发
+ */
 
 /**
- * @brief 打开ddriver设备
+ * @brief 打开ddriver设备，设备大小、IO单位等由配置决定：
+ *        默认值 < DDRIVER_CONFIG指向的配置文件 < 环境变量DDRIVER_DISK_SZ等，
+ *        环境变量DDRIVER_MMAP非0时以mmap方式打开，
+ *        DDRIVER_NODELAY非0时不模拟延迟，DDRIVER_SIMCLOCK非0时只推进模拟时钟不休眠，
+ *        DDRIVER_WCACHE非0时启用该大小的易失写缓存，写入在flush或关闭时才落盘
  * 
- * @param path ddriver设备路径
+ * @param path 设备镜像路径，可以是任意文件，日志写入<path>_log；
+ *             一个进程同一时刻只能打开一个设备，一个镜像同一时刻只能被一个进程打开
  * @return int 0成功，否则失败
  */
 int ddriver_open(char *path);
 
 /**
- * @brief 移动ddriver磁盘头
+ * @brief 按指定方式打开ddriver设备
+ * 
+ * @param path ddriver设备路径
+ * @param flags 打开方式，查看ddriver_ctl_user，DDRIVER_OPEN_开头
+ * @return int 0成功，否则失败
+ */
+int ddriver_open_flags(char *path, int flags);
+
+/**
+ * @brief 按指定方式与几何参数打开ddriver设备
+ * 
+ * @param path ddriver设备路径
+ * @param flags 打开方式，查看ddriver_ctl_user，DDRIVER_OPEN_开头
+ * @param geo 设备几何参数，为NULL或字段为0时使用配置值
+ * @return int 0成功，否则失败
+ */
+int ddriver_open_geometry(char *path, int flags, const struct ddriver_geometry *geo);
+
+/**
+ * @brief 移动ddriver磁盘头，游标按线程保存
  * 
  * @param fd ddriver设备handler
  * @param offset 移动到的位置，注意要和设备IO单位对齐
@@ -42,6 +77,58 @@ int ddriver_write(int fd, char *buf, size_t size);
  */
 int ddriver_read(int fd, char *buf, size_t size);
 
+/**
+ * @brief 在指定位置写入数据，磁盘头已在该位置时不产生SEEK开销
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，可为设备IO单位的整数倍，一次请求完成
+ * @param offset 写入位置，注意要和设备IO单位对齐
+ * @return int 写入的字节数，失败返回负的错误号
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 从指定位置读出数据，磁盘头已在该位置时不产生SEEK开销
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，可为设备IO单位的整数倍，一次请求完成
+ * @param offset 读出位置，注意要和设备IO单位对齐
+ * @return int 读出的字节数，失败返回负的错误号
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 聚集写，将iov各段依次写入从offset开始的连续磁盘区间，一次请求完成
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 数据段数组，每段大小须为设备IO单位的整数倍
+ * @param iovcnt 数据段个数
+ * @param offset 写入位置，注意要和设备IO单位对齐
+ * @return int 写入的字节数，失败返回负的错误号
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+/**
+ * @brief 带标志的聚集写，参数同ddriver_writev
+ * 
+ * @param flags DDRIVER_WRITE_FUA：绕过写缓存，返回时数据已写入磁盘文件
+ * @return int 写入的字节数，失败返回负的错误号
+ */
+int ddriver_writev_flags(int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags);
+
+/**
+ * @brief 分散读，将从offset开始的连续磁盘区间依次读入iov各段，一次请求完成
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 数据段数组，每段大小须为设备IO单位的整数倍
+ * @param iovcnt 数据段个数
+ * @param offset 读出位置，注意要和设备IO单位对齐
+ * @return int 读出的字节数，失败返回负的错误号
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
 /**
  * @brief ddriver IO控制
  * 
@@ -60,4 +147,63 @@ int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
  */
 int ddriver_close(int fd);
 
+/**
+ * @brief 获取磁盘区间的直接访问指针，仅mmap方式打开时可用
+ * 
+ * @param fd ddriver设备handler
+ * @param offset 区间起始位置
+ * @param size 区间大小
+ * @return void* 区间首地址，通过该地址的读写不计入延迟与统计，失败返回NULL
+ */
+void *ddriver_map(int fd, off_t offset, size_t size);
+
+/**
+ * @brief 将已完成的写持久化到磁盘文件，启用了写缓存 (DDRIVER_WCACHE) 时
+ *        先写回缓存中的数据，与IOC_REQ_DEVICE_FLUSH等价
+ * 
+ * @param fd ddriver设备handler
+ * @return int 0成功，否则失败
+ */
+int ddriver_flush(int fd);
+
+/**
+ * @brief 批量提交异步读写请求，请求由驱动内部的工作线程并发执行
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 请求数组，完成前请勿释放或修改
+ * @param nr 请求个数
+ * @return int 被接受的请求数，在途请求达到DDRIVER_ASYNC_DEPTH时可能少于nr
+ */
+int ddriver_async_submit(int fd, struct ddriver_req *reqs, int nr);
+
+/**
+ * @brief 收割已完成的异步请求，不阻塞
+ * 
+ * @param fd ddriver设备handler
+ * @param done 返回已完成请求的指针，结果见各请求的res字段
+ * @param max done数组容量
+ * @return int 收割的请求数
+ */
+int ddriver_async_poll(int fd, struct ddriver_req **done, int max);
+
+/**
+ * @brief 等待至少min个异步请求完成后收割
+ * 
+ * @param fd ddriver设备handler
+ * @param done 返回已完成请求的指针，结果见各请求的res字段
+ * @param min 至少等待的请求数
+ * @param max done数组容量
+ * @return int 收割的请求数
+ */
+int ddriver_async_wait(int fd, struct ddriver_req **done, int min, int max);
+
+/**
+ * @brief 设置本线程之后请求的轨迹标签，配置了trace (DDRIVER_TRACE) 时随请求记录
+ *        到轨迹文件，可用ddriver_replay重放
+ * 
+ * @param tag 调用者自定义，例如区分元数据与数据
+ * @return int 之前的标签
+ */
+int ddriver_trace_tag(int tag);
+
 #endif /* _DDRIVER_H_ */
\ No newline at end of file